@@ -0,0 +1,256 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "epd29.hpp"
+#include "epd_ghosting.hpp"
+
+namespace pidisp::epd {
+
+// Runs Epd29 operations on a worker thread so the caller is not blocked for
+// the seconds a refresh takes. Operations run in submission order, and each
+// one starts as soon as the previous BUSY wait returns. The returned futures
+// become ready when BUSY releases, and carry any exception thrown by the driver.
+//
+// Frames submitted while a refresh is in flight are coalesced: a display()
+// that finds another not-yet-started display() at the tail of the queue
+// replaces its frame, so the next refresh shows the newest state. The damage
+// region is recomputed against what is on the glass, so it covers everything
+// the skipped frames touched. All merged futures receive the same report.
+//
+// A GhostingScheduler picks the waveform for every update, so the requested
+// mode is a hint: PARTIAL may be promoted to FULL, and an idle worker may run
+// a cleanup refresh on its own.
+//
+// Programs that already run a pidisp::Executor (duel --coop, compositord)
+// need no extra thread: they await display_scheduled() directly.
+class AsyncEpd {
+public:
+    struct Stats {
+        uint64_t submitted;  // display() calls
+        uint64_t coalesced;  // of those, merged into an already queued update
+        uint64_t refreshes;
+    };
+
+    explicit AsyncEpd(Epd29& epd, GhostingConfig ghosting = {});
+    ~AsyncEpd();  // queued operations still run
+
+    AsyncEpd(const AsyncEpd&) = delete;
+    AsyncEpd& operator=(const AsyncEpd&) = delete;
+
+    std::future<UpdateReport> display(const Frame& frame, Refresh mode);
+    std::future<UpdateReport> display_gray(const GrayFrame& frame);  // never coalesced
+    std::future<void> clear();
+    std::future<void> deep_sleep();
+
+    size_t pending() const;
+    Stats stats() const;
+    GhostingScheduler::Counters ghosting() const;
+
+private:
+    // Either an arbitrary operation (`op` set) or a frame update that further
+    // display() calls may still be merged into.
+    struct Job {
+        std::function<void()> op;
+        Frame frame;
+        Refresh mode = Refresh::PARTIAL;
+        std::vector<std::promise<UpdateReport>> waiters;
+    };
+
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn>> enqueue(Fn&& fn);
+    void run_update(Job& job);
+    void run_idle_refresh();
+    void run();
+
+    Epd29& epd_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    bool stop_ = false;
+    uint64_t submitted_ = 0;
+    uint64_t coalesced_ = 0;
+    uint64_t refreshes_ = 0;
+    GhostingScheduler scheduler_;  // guarded by mutex_
+    bool asleep_ = false;          // worker only
+    std::thread thread_;
+};
+
+inline AsyncEpd::AsyncEpd(Epd29& epd, GhostingConfig ghosting)
+    : epd_(epd), scheduler_(ghosting), thread_([this] { run(); }) {}
+
+inline AsyncEpd::~AsyncEpd() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+template <typename Fn>
+std::future<std::invoke_result_t<Fn>> AsyncEpd::enqueue(Fn&& fn) {
+    // std::function needs a copyable target, so the task is shared.
+    auto task = std::make_shared<std::packaged_task<std::invoke_result_t<Fn>()>>(std::forward<Fn>(fn));
+    auto result = task->get_future();
+    {
+        std::lock_guard lock(mutex_);
+        jobs_.emplace_back().op = [task] { (*task)(); };
+    }
+    cv_.notify_one();
+    return result;
+}
+
+inline std::future<UpdateReport> AsyncEpd::display(const Frame& frame, Refresh mode) {
+    std::promise<UpdateReport> promise;
+    auto result = promise.get_future();
+    {
+        std::lock_guard lock(mutex_);
+        ++submitted_;
+        if (!jobs_.empty() && !jobs_.back().op) {
+            Job& queued = jobs_.back();
+            queued.frame = frame;
+            if (mode == Refresh::FULL) {
+                queued.mode = Refresh::FULL;
+            }
+            queued.waiters.push_back(std::move(promise));
+            ++coalesced_;
+            return result;
+        }
+
+        Job& job = jobs_.emplace_back();
+        job.frame = frame;
+        job.mode = mode;
+        job.waiters.push_back(std::move(promise));
+    }
+    cv_.notify_one();
+    return result;
+}
+
+inline std::future<UpdateReport> AsyncEpd::display_gray(const GrayFrame& frame) {
+    return enqueue([this, frame] {
+        epd_.display_gray(frame);
+        std::lock_guard lock(mutex_);
+        scheduler_.reset();
+        ++refreshes_;
+        return epd_.last_update();
+    });
+}
+
+inline std::future<void> AsyncEpd::clear() {
+    return enqueue([this] {
+        epd_.clear();
+        std::lock_guard lock(mutex_);
+        scheduler_.reset();
+    });
+}
+
+inline std::future<void> AsyncEpd::deep_sleep() {
+    return enqueue([this] {
+        asleep_ = true;
+        epd_.deep_sleep();
+    });
+}
+
+inline size_t AsyncEpd::pending() const {
+    std::lock_guard lock(mutex_);
+    return jobs_.size();
+}
+
+inline AsyncEpd::Stats AsyncEpd::stats() const {
+    std::lock_guard lock(mutex_);
+    return {submitted_, coalesced_, refreshes_};
+}
+
+inline GhostingScheduler::Counters AsyncEpd::ghosting() const {
+    std::lock_guard lock(mutex_);
+    return scheduler_.counters();
+}
+
+inline void AsyncEpd::run_update(Job& job) {
+    try {
+        // Diffed once: the box both picks the waveform and is the partial window.
+        const auto start = std::chrono::steady_clock::now();
+        const DirtyBox box = diff_box(epd_.last_frame(), job.frame);
+        const auto diff_time = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+        Refresh mode;
+        {
+            std::lock_guard lock(mutex_);
+            mode = scheduler_.choose(box, job.mode);
+        }
+        epd_.display(job.frame, mode, box);
+        UpdateReport report = epd_.last_update();
+        report.diff_time = diff_time;
+        report.coalesced = job.waiters.size() - 1;
+        {
+            std::lock_guard lock(mutex_);
+            scheduler_.record(report.mode, report.box);
+            if (!report.box.empty()) {
+                ++refreshes_;
+            }
+        }
+        for (auto& waiter : job.waiters) {
+            waiter.set_value(report);
+        }
+    } catch (...) {
+        for (auto& waiter : job.waiters) {
+            waiter.set_exception(std::current_exception());
+        }
+    }
+}
+
+// Full refresh of what is already displayed, to clear accumulated ghosting.
+inline void AsyncEpd::run_idle_refresh() {
+    epd_.display(epd_.last_frame(), Refresh::FULL);
+    std::lock_guard lock(mutex_);
+    scheduler_.record_idle_refresh();
+}
+
+inline void AsyncEpd::run() {
+    const auto ready = [this] { return stop_ || !jobs_.empty(); };
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock lock(mutex_);
+            if (!asleep_ && scheduler_.wants_idle_refresh()) {
+                if (!cv_.wait_for(lock, scheduler_.config().idle_after, ready)) {
+                    lock.unlock();
+                    try {
+                        run_idle_refresh();
+                    } catch (const std::exception& ex) {
+                        std::cerr << "idle refresh failed: " << ex.what() << "\n";
+                    }
+                    continue;
+                }
+            } else {
+                cv_.wait(lock, ready);
+            }
+            if (jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        if (job.op) {
+            job.op();
+        } else {
+            run_update(job);
+        }
+    }
+}
+
+}  // namespace pidisp::epd
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include <gpiod.hpp>
+
+#include "task.hpp"
+
+namespace pidisp {
+
+// Waits for a controller's BUSY input to release. When the line was requested
+// with edge detection the wait blocks in the kernel until an edge arrives;
+// otherwise it falls back to polling. Only needs a line_request, so it can be
+// exercised against a gpio-sim chip without any SPI hardware.
+class BusyLine {
+public:
+    // Input with pull-up, plus edge detection on both edges when `edges` is set.
+    static gpiod::line_settings settings(bool edges) {
+        gpiod::line_settings s;
+        s.set_direction(gpiod::line::direction::INPUT);
+        s.set_bias(gpiod::line::bias::PULL_UP);
+        if (edges) {
+            s.set_edge_detection(gpiod::line::edge::BOTH);
+        }
+        return s;
+    }
+
+    BusyLine(gpiod::line_request& request, unsigned int offset, bool active_high, bool edges)
+        : request_(request), offset_(offset), active_high_(active_high), edges_(edges), events_(16) {}
+
+    bool edge_driven() const { return edges_; }
+
+    bool asserted() {
+        const auto value = request_.get_value(offset_);
+        return active_high_ ? value == gpiod::line::value::ACTIVE
+                            : value == gpiod::line::value::INACTIVE;
+    }
+
+    // Returns how long BUSY stayed asserted; throws on timeout. The level is
+    // re-read after every wakeup, so stale queued edges only cost a re-check.
+    std::chrono::milliseconds wait_release(std::chrono::milliseconds timeout,
+                                           std::chrono::milliseconds poll) {
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + timeout;
+
+        if (edges_) {
+            drain();
+        }
+
+        while (asserted()) {
+            const auto now = std::chrono::steady_clock::now();
+            if (now > deadline) {
+                throw std::runtime_error("timeout waiting for BUSY release");
+            }
+            if (edges_) {
+                if (request_.wait_edge_events(deadline - now)) {
+                    drain();
+                }
+            } else {
+                std::this_thread::sleep_for(poll);
+            }
+        }
+
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+    }
+
+    // The same wait as a task. Under an Executor the edge wait becomes a poll
+    // on the request's fd (or a delay() per poll interval), so other tasks
+    // run while BUSY is held; elsewhere it is wait_release().
+    Task<std::chrono::milliseconds> wait_release_async(std::chrono::milliseconds timeout,
+                                                       std::chrono::milliseconds poll) {
+        if (!detail::current_executor()) {
+            co_return wait_release(timeout, poll);
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto deadline = start + timeout;
+
+        if (edges_) {
+            drain();
+        }
+
+        while (asserted()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                throw std::runtime_error("timeout waiting for BUSY release");
+            }
+            if (edges_) {
+                if (co_await readable(request_.fd(), deadline)) {
+                    drain();
+                }
+            } else {
+                co_await delay(poll);
+            }
+        }
+
+        co_return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+    }
+
+private:
+    void drain() {
+        while (request_.wait_edge_events(std::chrono::nanoseconds(0))) {
+            request_.read_edge_events(events_);
+        }
+    }
+
+    gpiod::line_request& request_;
+    unsigned int offset_;
+    bool active_high_;
+    bool edges_;
+    gpiod::edge_event_buffer events_;
+};
+
+}  // namespace pidisp
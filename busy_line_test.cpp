@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <gpiod.hpp>
+
+#include "busy_line.hpp"
+#include "task.hpp"
+
+// Checks that BusyLine::wait_release() returns on the BUSY release, with edge
+// detection and with the polling fallback, against a gpio-sim chip. Needs
+// root and the gpio-sim module (modprobe gpio-sim); without them the test is
+// skipped with exit status 77.
+
+namespace {
+
+constexpr char CONFIGFS[] = "/sys/kernel/config/gpio-sim";
+constexpr unsigned int BUSY_OFFSET = 0;
+constexpr auto HOLD = std::chrono::milliseconds(100);  // how long BUSY stays asserted
+constexpr auto POLL = std::chrono::milliseconds(10);
+constexpr auto SLACK = std::chrono::milliseconds(20);  // scheduling noise allowed on top
+
+void write_file(const std::string& path, const std::string& value) {
+    const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0 || write(fd, value.data(), value.size()) != ssize_t(value.size())) {
+        const int err = errno;
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("cannot write " + path + ": " + std::strerror(err));
+    }
+    close(fd);
+}
+
+std::string read_file(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("cannot read " + path + ": " + std::strerror(errno));
+    }
+    char buf[64];
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (n <= 0) {
+        throw std::runtime_error("cannot read " + path);
+    }
+    std::string value(buf, n);
+    while (!value.empty() && value.back() == '\n') {
+        value.pop_back();
+    }
+    return value;
+}
+
+// A one-bank gpio-sim chip, created through configfs and removed again on
+// destruction. The input value of a simulated line follows its pull.
+class GpioSim {
+public:
+    explicit GpioSim(unsigned int lines)
+        : dir_(std::string(CONFIGFS) + "/pidisp-busy-" + std::to_string(getpid())) {
+        make_dir(dir_);
+        make_dir(dir_ + "/bank0");
+        write_file(dir_ + "/bank0/num_lines", std::to_string(lines));
+        write_file(dir_ + "/live", "1");
+        live_ = true;
+        chip_ = read_file(dir_ + "/bank0/chip_name");
+        sysfs_ = "/sys/devices/platform/" + read_file(dir_ + "/dev_name") + "/" + chip_;
+
+        // Without udev the node can lag the chip by a moment.
+        for (int i = 0; access(path().c_str(), R_OK | W_OK) != 0; ++i) {
+            if (i == 100) {
+                throw std::runtime_error(path() + " did not appear");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    ~GpioSim() {
+        if (live_) {
+            try {
+                write_file(dir_ + "/live", "0");
+            } catch (const std::exception&) {
+            }
+        }
+        rmdir((dir_ + "/bank0").c_str());
+        rmdir(dir_.c_str());
+    }
+
+    GpioSim(const GpioSim&) = delete;
+    GpioSim& operator=(const GpioSim&) = delete;
+
+    std::string path() const { return "/dev/" + chip_; }
+
+    void set_pull(unsigned int offset, bool up) {
+        write_file(sysfs_ + "/sim_gpio" + std::to_string(offset) + "/pull", up ? "pull-up" : "pull-down");
+    }
+
+private:
+    void make_dir(const std::string& path) {
+        if (mkdir(path.c_str(), 0755) < 0) {
+            throw std::runtime_error("cannot create " + path + ": " + std::strerror(errno));
+        }
+    }
+
+    std::string dir_;
+    std::string chip_;
+    std::string sysfs_;
+    bool live_ = false;
+};
+
+// Asserts BUSY (active low, as on the EPD controllers), releases it HOLD
+// later from another thread and checks how soon after the release the wait
+// returned.
+bool check(GpioSim& sim, bool edges, bool async) {
+    const std::string name = std::string(edges ? "edge" : "poll") + (async ? ", executor" : "");
+
+    gpiod::chip chip(sim.path());
+    auto request = chip.prepare_request()
+                       .set_consumer("busy_line_test")
+                       .add_line_settings(BUSY_OFFSET, pidisp::BusyLine::settings(edges))
+                       .do_request();
+    pidisp::BusyLine busy(request, BUSY_OFFSET, false, edges);
+
+    sim.set_pull(BUSY_OFFSET, false);
+    if (!busy.asserted()) {
+        std::cout << "FAIL " << name << ": BUSY not asserted after pulling the line low\n";
+        return false;
+    }
+
+    std::chrono::steady_clock::time_point released;
+    std::exception_ptr release_error;
+    std::thread releaser([&] {
+        std::this_thread::sleep_for(HOLD);
+        released = std::chrono::steady_clock::now();
+        try {
+            sim.set_pull(BUSY_OFFSET, true);
+        } catch (...) {
+            release_error = std::current_exception();
+        }
+    });
+
+    std::chrono::milliseconds waited{};
+    try {
+        if (async) {
+            // Named, so the closure outlives the coroutine that refers to it.
+            const auto wait = [&]() -> pidisp::Task<> {
+                waited = co_await busy.wait_release_async(std::chrono::seconds(2), POLL);
+            };
+            pidisp::Executor executor;
+            executor.spawn(wait());
+            executor.run();
+        } else {
+            waited = busy.wait_release(std::chrono::seconds(2), POLL);
+        }
+    } catch (...) {
+        releaser.join();
+        throw;
+    }
+    const auto returned = std::chrono::steady_clock::now();
+    releaser.join();
+    if (release_error) {
+        std::rethrow_exception(release_error);
+    }
+
+    const auto lag = std::chrono::duration_cast<std::chrono::microseconds>(returned - released);
+    const auto limit = edges ? SLACK : POLL + SLACK;
+    const bool ok = lag.count() >= 0 && lag < limit && !busy.asserted();
+    std::cout << (ok ? "PASS " : "FAIL ") << name << ": waited " << waited.count() << " ms, returned "
+              << lag.count() << " us after the release (limit " << limit.count() << " ms)\n";
+    return ok;
+}
+
+}  // namespace
+
+int main() {
+    struct stat st{};
+    if (stat(CONFIGFS, &st) != 0 || !S_ISDIR(st.st_mode) || access(CONFIGFS, W_OK) != 0) {
+        std::cout << "SKIP: gpio-sim is not available (needs root, configfs and modprobe gpio-sim)\n";
+        return 77;
+    }
+
+    try {
+        GpioSim sim(1);
+        bool ok = true;
+        for (bool edges : {true, false}) {
+            for (bool async : {false, true}) {
+                ok = check(sim, edges, async) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    } catch (const std::exception& ex) {
+        std::cerr << "busy_line_test failed: " << ex.what() << "\n";
+        return 1;
+    }
+}
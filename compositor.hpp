@@ -0,0 +1,383 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Wire protocol of compositord, the daemon that owns both panels, and the
+// client side of it. Messages are fixed-size structs on a SOCK_SEQPACKET
+// Unix socket, so every recv() is exactly one message. Pixels never travel
+// over the socket: at HELLO the daemon hands the client a sealed memfd with
+// SLOTS frame buffers, the client draws into one and SUBMITs its index with
+// a damage rectangle, and the daemon reads the pixels straight out of the
+// shared mapping. A slot belongs to the daemon from SUBMIT until the
+// matching DONE.
+namespace pidisp::compositor {
+
+constexpr char SOCKET_PATH[] = "/tmp/pidisp-compositor.sock";
+constexpr uint32_t PROTOCOL_VERSION = 1;
+constexpr uint32_t SLOTS = 2;         // double-buffered: draw one while the other is shown
+constexpr size_t MAX_CLIENTS = 16;
+constexpr size_t NAME_LEN = 32;
+
+// Buffer layouts: GC9 slots are host-order RGB565, 240x240; EPD slots are
+// 128x296 1bpp, MSB first, 1 = white, exactly as pidisp::epd::Frame.
+enum class Panel : uint32_t { GC9 = 0, EPD = 1 };
+
+enum class MsgType : uint32_t { HELLO = 1, WELCOME, SUBMIT, DONE, STATS, STATS_REPLY, ERROR };
+
+// Panel pixels the client changed. All zero means the whole panel.
+struct Damage {
+    uint16_t x = 0;
+    uint16_t y = 0;
+    uint16_t w = 0;
+    uint16_t h = 0;
+
+    bool whole() const { return !w || !h; }
+};
+
+// client -> daemon, first message. Answered with WELCOME plus the memfd.
+struct Hello {
+    MsgType type = MsgType::HELLO;
+    uint32_t version = PROTOCOL_VERSION;
+    Panel panel = Panel::GC9;
+    char name[NAME_LEN] = {};
+};
+
+struct Welcome {
+    MsgType type = MsgType::WELCOME;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;  // bytes per row
+    uint32_t slots = 0;
+    uint32_t slot_bytes = 0;  // slot i starts at i * slot_bytes
+};
+
+// client -> daemon. Answered with DONE once the panel shows the frame.
+struct Submit {
+    MsgType type = MsgType::SUBMIT;
+    uint32_t seq = 0;
+    uint32_t slot = 0;
+    uint32_t full_refresh = 0;  // EPD only: full waveform instead of partial
+    Damage damage;
+};
+
+struct Done {
+    MsgType type = MsgType::DONE;
+    uint32_t seq = 0;
+    uint32_t latency_us = 0;  // SUBMIT received to panel update finished
+    uint32_t batched = 0;     // submits (from all clients) folded into the same update
+};
+
+// Per-client numbers as the daemon sees them: average and p95 latency over
+// the recent frames, maximum since the client connected.
+struct ClientStats {
+    char name[NAME_LEN] = {};
+    Panel panel = Panel::GC9;
+    uint32_t frames = 0;
+    uint32_t avg_us = 0;
+    uint32_t p95_us = 0;
+    uint32_t max_us = 0;
+};
+
+// Any connection may ask, before or after HELLO.
+struct StatsRequest {
+    MsgType type = MsgType::STATS;
+};
+
+struct StatsReply {
+    MsgType type = MsgType::STATS_REPLY;
+    uint32_t count = 0;
+    std::array<ClientStats, MAX_CLIENTS> clients{};
+};
+
+// daemon -> client, then the daemon hangs up.
+struct Error {
+    MsgType type = MsgType::ERROR;
+    char message[96] = {};
+};
+
+// Fills a fixed-size, NUL-terminated message field, truncating `src`.
+template <size_t N>
+void copy_string(char (&dst)[N], const std::string& src) {
+    const size_t n = std::min(src.size(), N - 1);
+    std::memcpy(dst, src.data(), n);
+    dst[n] = '\0';
+}
+
+// One received message, plus the descriptor attached to it, if any.
+struct Packet {
+    std::array<uint8_t, sizeof(StatsReply)> bytes;  // room for the largest message
+    size_t size = 0;
+    int fd = -1;
+
+    MsgType type() const {
+        MsgType t{};
+        std::memcpy(&t, bytes.data(), std::min(size, sizeof(t)));
+        return t;
+    }
+
+    template <typename T>
+    T as() const {
+        if (size != sizeof(T)) {
+            throw std::runtime_error("malformed compositor message");
+        }
+        T msg;
+        std::memcpy(&msg, bytes.data(), sizeof(T));
+        return msg;
+    }
+};
+
+// Sends one message, optionally passing `fd` along with it (SCM_RIGHTS).
+template <typename T>
+void send_message(int sock, const T& msg, int fd = -1) {
+    iovec iov{const_cast<T*>(&msg), sizeof(T)};
+    msghdr hdr{};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    if (sendmsg(sock, &hdr, MSG_NOSIGNAL) != ssize_t(sizeof(T))) {
+        throw std::runtime_error("compositor send failed: " + std::string(std::strerror(errno)));
+    }
+}
+
+enum class Received { MESSAGE, HUNG_UP, NOTHING };
+
+// Reads one message. NOTHING only happens on non-blocking sockets.
+inline Received receive_message(int sock, Packet& packet) {
+    iovec iov{packet.bytes.data(), packet.bytes.size()};
+    msghdr hdr{};
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    const ssize_t n = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return Received::NOTHING;
+    }
+    if (n < 0) {
+        throw std::runtime_error("compositor receive failed: " + std::string(std::strerror(errno)));
+    }
+    packet.size = size_t(n);
+    packet.fd = -1;
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            std::memcpy(&packet.fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    return n > 0 ? Received::MESSAGE : Received::HUNG_UP;
+}
+
+// A shared mapping of a memfd, unmapped on destruction.
+class SharedBuffer {
+public:
+    SharedBuffer() = default;
+    SharedBuffer(const SharedBuffer&) = delete;
+    SharedBuffer& operator=(const SharedBuffer&) = delete;
+    SharedBuffer(SharedBuffer&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {}
+    SharedBuffer& operator=(SharedBuffer&& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+    ~SharedBuffer() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    // Creates a memfd of `size` bytes, sealed against resizing so a client
+    // cannot truncate it under the daemon's mapping, and maps it with `prot`.
+    // The caller owns the returned fd.
+    static SharedBuffer create(const char* name, size_t size, int prot, int& fd) {
+        fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+            throw std::runtime_error("memfd_create failed: " + std::string(std::strerror(errno)));
+        }
+        if (ftruncate(fd, off_t(size)) < 0 ||
+            fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+            const int err = errno;
+            close(fd);
+            throw std::runtime_error("failed to size memfd: " + std::string(std::strerror(err)));
+        }
+        try {
+            return map(fd, size, prot);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+    }
+
+    static SharedBuffer map(int fd, size_t size, int prot) {
+        void* data = mmap(nullptr, size, prot, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("mmap failed: " + std::string(std::strerror(errno)));
+        }
+        SharedBuffer buffer;
+        buffer.data_ = static_cast<uint8_t*>(data);
+        buffer.size_ = size;
+        return buffer;
+    }
+
+    uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+inline int connect_socket(const std::string& path) {
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("socket path too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        throw std::runtime_error("socket failed: " + std::string(std::strerror(errno)));
+    }
+    if (connect(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0) {
+        const int err = errno;
+        close(sock);
+        throw std::runtime_error("cannot reach compositor at " + path + ": " + std::strerror(err));
+    }
+    return sock;
+}
+
+// One panel's worth of client state: the connection, the mapped slots and
+// the DONEs not yet collected.
+class Client {
+public:
+    Client(Panel panel, const std::string& name, const std::string& path = SOCKET_PATH)
+        : sock_(connect_socket(path)) {
+        try {
+            Hello hello;
+            hello.panel = panel;
+            copy_string(hello.name, name);
+            send_message(sock_, hello);
+
+            Packet reply = receive(MsgType::WELCOME);
+            if (reply.fd < 0) {
+                throw std::runtime_error("compositor sent no buffer");
+            }
+            welcome_ = reply.as<Welcome>();
+            buffer_ = SharedBuffer::map(reply.fd, size_t(welcome_.slots) * welcome_.slot_bytes,
+                                        PROT_READ | PROT_WRITE);
+            close(reply.fd);
+        } catch (...) {
+            close(sock_);
+            throw;
+        }
+    }
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+    ~Client() { close(sock_); }
+
+    const Welcome& layout() const { return welcome_; }
+    uint8_t* slot(uint32_t index) { return buffer_.data() + size_t(index) * welcome_.slot_bytes; }
+
+    // Hands `slot` to the daemon; don't touch it until its DONE is collected.
+    uint32_t submit(uint32_t slot, Damage damage = {}, bool full_refresh = false) {
+        Submit msg;
+        msg.seq = ++seq_;
+        msg.slot = slot;
+        msg.full_refresh = full_refresh;
+        msg.damage = damage;
+        send_message(sock_, msg);
+        return msg.seq;
+    }
+
+    // Blocks for the next DONE, in submit order.
+    Done wait_done() {
+        if (!done_.empty()) {
+            const Done done = done_.front();
+            done_.pop_front();
+            return done;
+        }
+        return receive(MsgType::DONE).as<Done>();
+    }
+
+    StatsReply stats() {
+        send_message(sock_, StatsRequest{});
+        return receive(MsgType::STATS_REPLY).as<StatsReply>();
+    }
+
+    int fd() const { return sock_; }
+
+private:
+    // Reads until a message of type `want`, queueing DONEs that arrive first.
+    Packet receive(MsgType want) {
+        Packet packet;
+        for (;;) {
+            if (receive_message(sock_, packet) != Received::MESSAGE) {
+                throw std::runtime_error("compositor hung up");
+            }
+            if (packet.type() == want) {
+                return packet;
+            }
+            if (packet.type() == MsgType::ERROR) {
+                const Error error = packet.as<Error>();
+                throw std::runtime_error("compositor: " + std::string(error.message));
+            }
+            if (packet.type() == MsgType::DONE) {
+                done_.push_back(packet.as<Done>());
+            }
+        }
+    }
+
+    int sock_;
+    Welcome welcome_;
+    SharedBuffer buffer_;
+    std::deque<Done> done_;
+    uint32_t seq_ = 0;
+};
+
+// Stats without registering a panel, e.g. for monitoring tools.
+inline StatsReply query_stats(const std::string& path = SOCKET_PATH) {
+    const int sock = connect_socket(path);
+    Packet packet;
+    try {
+        send_message(sock, StatsRequest{});
+        if (receive_message(sock, packet) != Received::MESSAGE) {
+            throw std::runtime_error("compositor hung up");
+        }
+    } catch (...) {
+        close(sock);
+        throw;
+    }
+    close(sock);
+    return packet.as<StatsReply>();
+}
+
+}  // namespace pidisp::compositor
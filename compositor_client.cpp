@@ -0,0 +1,203 @@
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "compositor.hpp"
+#include "mono_canvas.hpp"
+
+// Example compositord client. `gc9` bounces a square across the LCD and
+// `epd` walks a bar down the e-paper panel, both submitting only the damage
+// of each frame from double-buffered shared memory; `stats` prints the
+// daemon's per-client latency table. No panel init, no GPIO, no spidev.
+
+namespace {
+
+namespace cmp = pidisp::compositor;
+
+struct Box {
+    int x, y, w, h;
+};
+
+// Smallest damage covering both boxes.
+cmp::Damage cover(const Box& a, const Box& b) {
+    const int x0 = std::min(a.x, b.x);
+    const int y0 = std::min(a.y, b.y);
+    const int x1 = std::max(a.x + a.w, b.x + b.w);
+    const int y1 = std::max(a.y + a.h, b.y + b.h);
+    return {uint16_t(x0), uint16_t(y0), uint16_t(x1 - x0), uint16_t(y1 - y0)};
+}
+
+// Keeps up to cmp::SLOTS frames in flight: a slot is only redrawn once the
+// DONE of its previous frame is back.
+class Pipeline {
+public:
+    explicit Pipeline(cmp::Client& client) : client_(client) {}
+
+    // The slot to draw the next frame into.
+    uint8_t* next() {
+        if (in_flight_ == cmp::SLOTS) {
+            collect();
+        }
+        return client_.slot(slot_);
+    }
+
+    void submit(const cmp::Damage& damage, bool full_refresh = false) {
+        client_.submit(slot_, damage, full_refresh);
+        slot_ = (slot_ + 1) % cmp::SLOTS;
+        ++in_flight_;
+    }
+
+    void drain() {
+        while (in_flight_) {
+            collect();
+        }
+    }
+
+private:
+    void collect() {
+        client_.wait_done();
+        --in_flight_;
+    }
+
+    cmp::Client& client_;
+    uint32_t slot_ = 0;
+    uint32_t in_flight_ = 0;
+};
+
+constexpr uint16_t COLORS[] = {0xF800, 0x07E0, 0x001F, 0xFFE0};  // red, green, blue, yellow
+
+void bounce(cmp::Client& client, int frames) {
+    const auto& layout = client.layout();
+    const int width = int(layout.width);
+    const int height = int(layout.height);
+    Pipeline pipeline(client);
+
+    Box box{width / 3, height / 4, 40, 40};
+    int dx = 3;
+    int dy = 2;
+    for (int n = 0; n < frames; ++n) {
+        const Box prev = box;
+        if (n > 0) {
+            if (box.x + dx < 0 || box.x + box.w + dx > width) {
+                dx = -dx;
+            }
+            if (box.y + dy < 0 || box.y + box.h + dy > height) {
+                dy = -dy;
+            }
+            box.x += dx;
+            box.y += dy;
+        }
+
+        // The slot still holds the frame from SLOTS ago, so the whole damaged
+        // area is redrawn, not just the edges that moved since last frame.
+        auto* px = reinterpret_cast<uint16_t*>(pipeline.next());
+        const cmp::Damage damage = n ? cover(prev, box) : cmp::Damage{};
+        const Box area = damage.whole() ? Box{0, 0, width, height}
+                                        : Box{damage.x, damage.y, damage.w, damage.h};
+        const uint16_t color = COLORS[n / 64 % 4];
+        for (int y = area.y; y < area.y + area.h; ++y) {
+            for (int x = area.x; x < area.x + area.w; ++x) {
+                const bool inside = x >= box.x && x < box.x + box.w && y >= box.y && y < box.y + box.h;
+                px[size_t(y) * layout.stride / 2 + x] = inside ? color : 0x0000;
+            }
+        }
+        pipeline.submit(damage);
+    }
+    pipeline.drain();
+}
+
+void walk(cmp::Client& client, int frames) {
+    const auto& layout = client.layout();
+    const int width = int(layout.width);
+    const int height = int(layout.height);
+    Pipeline pipeline(client);
+
+    constexpr int BAR = 24;
+    Box bar{0, 0, width, BAR};
+    for (int n = 0; n < frames; ++n) {
+        const Box prev = bar;
+        bar.y = n * BAR % (height - BAR);
+
+        pidisp::MonoCanvas canvas(pipeline.next(), width, height, layout.stride);
+        const cmp::Damage damage = n ? cover(prev, bar) : cmp::Damage{};
+        if (damage.whole()) {
+            canvas.fill(true);
+        } else {
+            canvas.fill_rect(damage.x, damage.y, damage.w, damage.h, true);
+        }
+        canvas.fill_rect(bar.x, bar.y, bar.w, bar.h, false);
+        pipeline.submit(damage, n == 0);  // start from a clean full refresh
+    }
+    pipeline.drain();
+}
+
+void print_stats(const cmp::StatsReply& reply) {
+    std::cout << std::left << std::setw(20) << "client" << " panel  frames  latency avg / p95 / max\n";
+    for (uint32_t i = 0; i < reply.count; ++i) {
+        const auto& st = reply.clients[i];
+        std::cout << std::left << std::setw(20) << st.name << std::right << " "
+                  << (st.panel == cmp::Panel::GC9 ? "gc9" : "epd") << std::setw(9) << st.frames << "  "
+                  << std::fixed << std::setprecision(2) << st.avg_us / 1000.0 << " / " << st.p95_us / 1000.0
+                  << " / " << st.max_us / 1000.0 << " ms\n";
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        if (argc < 2) {
+            std::cerr << "usage: " << argv[0] << " gc9|epd|stats [--frames N] [--socket PATH]\n";
+            return 2;
+        }
+        const std::string mode = argv[1];
+        std::string socket_path = cmp::SOCKET_PATH;
+        int frames = mode == "epd" ? 20 : 1000;
+        for (int i = 2; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--frames" && i + 1 < argc) {
+                frames = std::stoi(argv[++i]);
+            } else if (arg == "--socket" && i + 1 < argc) {
+                socket_path = argv[++i];
+            } else {
+                std::cerr << "unknown argument " << arg << "\n";
+                return 2;
+            }
+        }
+
+        if (mode == "stats") {
+            print_stats(cmp::query_stats(socket_path));
+            return 0;
+        }
+        if (mode != "gc9" && mode != "epd") {
+            std::cerr << "unknown mode " << mode << "\n";
+            return 2;
+        }
+
+        const bool lcd = mode == "gc9";
+        const std::string name = (lcd ? "bounce-" : "walk-") + std::to_string(getpid());
+        cmp::Client client(lcd ? cmp::Panel::GC9 : cmp::Panel::EPD, name, socket_path);
+
+        const auto start = std::chrono::steady_clock::now();
+        if (lcd) {
+            bounce(client, frames);
+        } else {
+            walk(client, frames);
+        }
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << name << ": " << frames << " frames in " << std::fixed << std::setprecision(2) << seconds
+                  << " s (" << std::setprecision(1) << frames / seconds << " fps)\n";
+        print_stats(client.stats());
+    } catch (const std::exception& ex) {
+        std::cerr << "Client failed: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
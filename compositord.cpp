@@ -0,0 +1,626 @@
+#include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <linux/spi/spidev.h>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "compositor.hpp"
+#include "epd29.hpp"
+#include "epd_ghosting.hpp"
+#include "gc9_panel.hpp"
+#include "gc9_presenter.hpp"
+#include "spi_bus.hpp"
+#include "task.hpp"
+
+// Long-running owner of both panels. The demos each re-initialize the GC9
+// and the EPD and fight over spidev and the GPIO lines; compositord brings
+// the panels up once and then takes frames from any number of client
+// processes over the socket described in compositor.hpp.
+//
+// Every client draws into its own full-panel layer. A submit copies the
+// layer's damage rectangle into the panel's composite (last writer wins) and
+// the panel's presenter sends the composite: tile-diffed on the GC9, as a
+// partial refresh on the EPD. Submits that arrive while a panel is busy are
+// folded into its next update. All of it runs as tasks on one
+// pidisp::Executor, so a 300 ms EPD refresh never holds up the GC9; the
+// GC9's pixel streaming itself runs on a gc9::AsyncPresenter thread so it
+// does not hold up the executor either.
+
+namespace {
+
+namespace gc9 = pidisp::gc9;
+namespace epd = pidisp::epd;
+namespace cmp = pidisp::compositor;
+
+using pidisp::Task;
+
+constexpr auto FOREVER = std::chrono::steady_clock::time_point::max();
+constexpr size_t LATENCY_WINDOW = 256;  // recent frames behind avg and p95
+
+// As in duel: the GC9 uses a GPIO chip select on spidev0.0 next to the EPD.
+constexpr uint32_t GC9_SPEED_HZ = 40'000'000;
+constexpr uint32_t GC9_STRIDE = gc9::PANEL_WIDTH * 2;
+constexpr uint32_t GC9_SLOT_BYTES = GC9_STRIDE * gc9::PANEL_HEIGHT;
+
+// Submit-to-done latency of one client.
+class LatencyMeter {
+public:
+    void add(std::chrono::microseconds latency) {
+        const uint32_t us = uint32_t(std::min<int64_t>(latency.count(), UINT32_MAX));
+        if (recent_.size() < LATENCY_WINDOW) {
+            recent_.push_back(us);
+        } else {
+            recent_[frames_ % LATENCY_WINDOW] = us;
+        }
+        ++frames_;
+        max_ = std::max(max_, us);
+    }
+
+    void fill(cmp::ClientStats& out) const {
+        out.frames = frames_;
+        out.max_us = max_;
+        if (recent_.empty()) {
+            return;
+        }
+        std::vector<uint32_t> sorted = recent_;
+        std::sort(sorted.begin(), sorted.end());
+        uint64_t total = 0;
+        for (uint32_t us : sorted) {
+            total += us;
+        }
+        out.avg_us = uint32_t(total / sorted.size());
+        out.p95_us = sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)];
+    }
+
+private:
+    std::vector<uint32_t> recent_;
+    uint32_t frames_ = 0;
+    uint32_t max_ = 0;
+};
+
+struct Connection {
+    explicit Connection(int fd) : sock(fd) {}
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+    ~Connection() { close(sock); }
+
+    int sock;
+    std::string name;
+    std::optional<cmp::Panel> panel;  // set by HELLO
+    cmp::SharedBuffer layers;
+    LatencyMeter latency;
+    bool open = true;
+
+    const uint8_t* slot(uint32_t index) const {
+        return layers.data() + size_t(index) * (layers.size() / cmp::SLOTS);
+    }
+};
+
+struct Submission {
+    std::shared_ptr<Connection> client;
+    cmp::Submit msg;
+    std::chrono::steady_clock::time_point received;
+};
+
+// Damage clipped to a panel, as half-open [x0, x1) x [y0, y1).
+struct Span {
+    int x0, y0, x1, y1;
+};
+
+Span clip(const cmp::Damage& d, int width, int height) {
+    if (d.whole()) {
+        return {0, 0, width, height};
+    }
+    return {std::min<int>(d.x, width), std::min<int>(d.y, height), std::min(d.x + d.w, width),
+            std::min(d.y + d.h, height)};
+}
+
+const char* panel_name(cmp::Panel panel) { return panel == cmp::Panel::GC9 ? "gc9" : "epd"; }
+
+class Compositor {
+public:
+    Compositor(pidisp::Executor& executor, gc9::Gc9Panel& lcd, epd::Epd29& paper)
+        : executor_(executor), lcd_(lcd, gc9::AsyncPresenter::Mode::FIFO), paper_(paper),
+          lcd_frame_(size_t(gc9::PANEL_WIDTH) * gc9::PANEL_HEIGHT, 0x0000),
+          paper_frame_(paper.last_frame()) {}
+
+    Task<> accept_clients(int listener);
+    Task<> present_gc9();
+    Task<> finish_gc9();
+    Task<> present_epd();
+    Task<> watch_epd_idle();
+
+    void print_clients(std::ostream& out) const;
+
+private:
+    Task<> serve(std::shared_ptr<Connection> conn);
+    void handle(const std::shared_ptr<Connection>& conn, const cmp::Packet& packet);
+    void welcome(Connection& conn, const cmp::Hello& hello);
+    void finish(const std::vector<Submission>& batch);
+    void drop(const std::shared_ptr<Connection>& conn);
+    cmp::StatsReply stats() const;
+    size_t registered() const;
+
+    void compose_gc9(const Submission& s);
+    void compose_epd(const Submission& s);
+
+    pidisp::Executor& executor_;
+    gc9::AsyncPresenter lcd_;
+    epd::Epd29& paper_;
+
+    std::vector<std::shared_ptr<Connection>> clients_;
+    std::vector<Submission> lcd_queue_;
+    std::deque<std::vector<Submission>> lcd_in_flight_;  // batches handed to lcd_, oldest first
+    std::vector<Submission> paper_queue_;
+    pidisp::Event lcd_wake_;
+    pidisp::Event paper_wake_;
+
+    std::vector<uint16_t> lcd_frame_;  // composite, host-order RGB565
+    epd::Frame paper_frame_;           // composite
+    epd::Frame paper_shown_;           // what the refresh in flight is showing
+    epd::GhostingScheduler ghosting_;
+    std::chrono::steady_clock::time_point paper_updated_ = std::chrono::steady_clock::now();
+
+    bool paper_idle() const {
+        return paper_queue_.empty() && ghosting_.wants_idle_refresh() &&
+               std::chrono::steady_clock::now() - paper_updated_ >= ghosting_.config().idle_after;
+    }
+};
+
+Task<> Compositor::accept_clients(int listener) {
+    for (;;) {
+        co_await pidisp::readable(listener, FOREVER);
+        const int sock = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock < 0) {
+            if (errno == EAGAIN || errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            throw std::runtime_error("accept failed: " + std::string(std::strerror(errno)));
+        }
+        auto conn = std::make_shared<Connection>(sock);
+        clients_.push_back(conn);
+        executor_.spawn(serve(std::move(conn)));
+    }
+}
+
+// One task per connection. A misbehaving client gets an ERROR and is dropped;
+// it never takes the daemon down.
+Task<> Compositor::serve(std::shared_ptr<Connection> conn) {
+    cmp::Packet packet;
+    try {
+        for (;;) {
+            co_await pidisp::readable(conn->sock, FOREVER);
+            const auto got = cmp::receive_message(conn->sock, packet);
+            if (got == cmp::Received::HUNG_UP) {
+                break;
+            }
+            if (got == cmp::Received::NOTHING) {
+                continue;
+            }
+            if (packet.fd >= 0) {
+                close(packet.fd);  // clients have nothing to pass
+            }
+            handle(conn, packet);
+        }
+    } catch (const std::exception& ex) {
+        cmp::Error error;
+        cmp::copy_string(error.message, ex.what());
+        try {
+            cmp::send_message(conn->sock, error);
+        } catch (const std::exception&) {
+        }
+    }
+    drop(conn);
+}
+
+void Compositor::handle(const std::shared_ptr<Connection>& conn, const cmp::Packet& packet) {
+    switch (packet.type()) {
+    case cmp::MsgType::HELLO:
+        welcome(*conn, packet.as<cmp::Hello>());
+        break;
+    case cmp::MsgType::SUBMIT: {
+        const auto msg = packet.as<cmp::Submit>();
+        if (!conn->panel) {
+            throw std::runtime_error("SUBMIT before HELLO");
+        }
+        if (msg.slot >= cmp::SLOTS) {
+            throw std::runtime_error("no such slot");
+        }
+        const Submission s{conn, msg, std::chrono::steady_clock::now()};
+        if (*conn->panel == cmp::Panel::GC9) {
+            lcd_queue_.push_back(s);
+            lcd_wake_.set();
+        } else {
+            paper_queue_.push_back(s);
+            paper_wake_.set();
+        }
+        break;
+    }
+    case cmp::MsgType::STATS:
+        cmp::send_message(conn->sock, stats());
+        break;
+    default:
+        throw std::runtime_error("unexpected message");
+    }
+}
+
+// Gives the client its layers, seeded with what the panel shows now so it
+// can start with damage-only submits.
+void Compositor::welcome(Connection& conn, const cmp::Hello& hello) {
+    if (conn.panel) {
+        throw std::runtime_error("HELLO sent twice");
+    }
+    if (hello.version != cmp::PROTOCOL_VERSION) {
+        throw std::runtime_error("protocol version mismatch");
+    }
+    if (hello.panel != cmp::Panel::GC9 && hello.panel != cmp::Panel::EPD) {
+        throw std::runtime_error("unknown panel");
+    }
+    if (registered() >= cmp::MAX_CLIENTS) {
+        throw std::runtime_error("too many clients");
+    }
+
+    cmp::Welcome reply;
+    const uint8_t* seed;
+    if (hello.panel == cmp::Panel::GC9) {
+        reply.width = gc9::PANEL_WIDTH;
+        reply.height = gc9::PANEL_HEIGHT;
+        reply.stride = GC9_STRIDE;
+        reply.slot_bytes = GC9_SLOT_BYTES;
+        seed = reinterpret_cast<const uint8_t*>(lcd_frame_.data());
+    } else {
+        reply.width = epd::PANEL_WIDTH;
+        reply.height = epd::PANEL_HEIGHT;
+        reply.stride = epd::ROW_BYTES;
+        reply.slot_bytes = epd::BUFFER_SIZE;
+        seed = paper_frame_.data();
+    }
+    reply.slots = cmp::SLOTS;
+
+    int fd = -1;
+    conn.layers = cmp::SharedBuffer::create("pidisp-layer", size_t(reply.slots) * reply.slot_bytes,
+                                            PROT_READ | PROT_WRITE, fd);
+    for (uint32_t i = 0; i < reply.slots; ++i) {
+        std::memcpy(conn.layers.data() + size_t(i) * reply.slot_bytes, seed, reply.slot_bytes);
+    }
+    try {
+        cmp::send_message(conn.sock, reply, fd);
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+
+    conn.name.assign(hello.name, strnlen(hello.name, sizeof(hello.name)));
+    conn.panel = hello.panel;
+    std::cout << "client '" << conn.name << "' connected (" << panel_name(hello.panel) << ")\n";
+}
+
+void Compositor::compose_gc9(const Submission& s) {
+    const Span span = clip(s.msg.damage, gc9::PANEL_WIDTH, gc9::PANEL_HEIGHT);
+    const uint8_t* layer = s.client->slot(s.msg.slot);
+    for (int y = span.y0; y < span.y1; ++y) {
+        std::memcpy(lcd_frame_.data() + size_t(y) * gc9::PANEL_WIDTH + span.x0,
+                    layer + size_t(y) * GC9_STRIDE + span.x0 * 2, size_t(span.x1 - span.x0) * 2);
+    }
+}
+
+// Damage is widened to whole bytes; the client owns the entire layer, so the
+// extra pixels are its own.
+void Compositor::compose_epd(const Submission& s) {
+    const Span span = clip(s.msg.damage, epd::PANEL_WIDTH, epd::PANEL_HEIGHT);
+    if (span.x1 <= span.x0) {
+        return;
+    }
+    const int bx0 = span.x0 / 8;
+    const int bx1 = (span.x1 + 7) / 8;
+    const uint8_t* layer = s.client->slot(s.msg.slot);
+    for (int y = span.y0; y < span.y1; ++y) {
+        const size_t row = size_t(y) * epd::ROW_BYTES;
+        std::memcpy(paper_frame_.data() + row + bx0, layer + row + bx0, bx1 - bx0);
+    }
+}
+
+// Hands each composite to the presenter thread, one frame at a time: submits
+// that arrive while a frame streams wait in lcd_queue_ and are folded into
+// the next one once finish_gc9() retires it. begin_frame() therefore always
+// finds a free slot and never blocks the executor.
+Task<> Compositor::present_gc9() {
+    for (;;) {
+        co_await lcd_wake_.wait();
+        if (lcd_queue_.empty() || !lcd_in_flight_.empty()) {
+            continue;
+        }
+        auto batch = std::exchange(lcd_queue_, {});
+        for (const Submission& s : batch) {
+            compose_gc9(s);
+        }
+        std::memcpy(lcd_.begin_frame(), lcd_frame_.data(), GC9_SLOT_BYTES);
+        lcd_.submit();
+        lcd_in_flight_.push_back(std::move(batch));
+    }
+}
+
+// FIFO mode presents every frame in order, so completions retire the
+// in-flight batches front to back.
+Task<> Compositor::finish_gc9() {
+    for (;;) {
+        co_await pidisp::readable(lcd_.presented_fd(), FOREVER);
+        for (uint64_t n = lcd_.collect(); n && !lcd_in_flight_.empty(); --n) {
+            finish(lcd_in_flight_.front());
+            lcd_in_flight_.pop_front();
+        }
+        lcd_wake_.set();
+    }
+}
+
+// Partial refreshes unless a submit in the batch asks for a full one or the
+// ghosting scheduler promotes it. The composite keeps taking submits while
+// the refresh runs, so the refresh gets a copy of its own. A wakeup with no
+// submits comes from watch_epd_idle() and cleans up the ghosting instead.
+Task<> Compositor::present_epd() {
+    for (;;) {
+        co_await paper_wake_.wait();
+        if (paper_queue_.empty()) {
+            if (paper_idle()) {
+                paper_shown_ = paper_.last_frame();
+                co_await paper_.display_async(paper_shown_, epd::Refresh::FULL);
+                ghosting_.record_idle_refresh();
+                paper_updated_ = std::chrono::steady_clock::now();
+            }
+            continue;
+        }
+
+        const auto batch = std::exchange(paper_queue_, {});
+        bool full = false;
+        for (const Submission& s : batch) {
+            compose_epd(s);
+            full = full || s.msg.full_refresh;
+        }
+        paper_shown_ = paper_frame_;
+        co_await epd::display_scheduled(paper_, ghosting_, paper_shown_,
+                                        full ? epd::Refresh::FULL : epd::Refresh::PARTIAL);
+        paper_updated_ = std::chrono::steady_clock::now();
+        finish(batch);
+    }
+}
+
+// Wakes present_epd() once the EPD has sat idle long enough with ghosting
+// worth a cleanup refresh.
+Task<> Compositor::watch_epd_idle() {
+    const auto period = ghosting_.config().idle_after / 4;
+    for (;;) {
+        co_await pidisp::delay(period);
+        if (paper_idle()) {
+            paper_wake_.set();
+        }
+    }
+}
+
+void Compositor::finish(const std::vector<Submission>& batch) {
+    const auto now = std::chrono::steady_clock::now();
+    for (const Submission& s : batch) {
+        const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(now - s.received);
+        s.client->latency.add(latency);
+        if (!s.client->open) {
+            continue;
+        }
+        cmp::Done done;
+        done.seq = s.msg.seq;
+        done.latency_us = uint32_t(std::min<int64_t>(latency.count(), UINT32_MAX));
+        done.batched = uint32_t(batch.size());
+        try {
+            cmp::send_message(s.client->sock, done);
+        } catch (const std::exception&) {
+            // A client that stopped reading its DONEs; serve() sees the hangup.
+            shutdown(s.client->sock, SHUT_RDWR);
+        }
+    }
+}
+
+void Compositor::drop(const std::shared_ptr<Connection>& conn) {
+    conn->open = false;
+    clients_.erase(std::remove(clients_.begin(), clients_.end(), conn), clients_.end());
+    if (!conn->panel) {
+        return;
+    }
+    cmp::ClientStats st;
+    conn->latency.fill(st);
+    std::cout << "client '" << conn->name << "' disconnected after " << st.frames
+              << " frames, latency avg " << std::fixed << std::setprecision(2) << st.avg_us / 1000.0
+              << " / p95 " << st.p95_us / 1000.0 << " / max " << st.max_us / 1000.0 << " ms\n";
+}
+
+size_t Compositor::registered() const {
+    return std::count_if(clients_.begin(), clients_.end(), [](const auto& c) { return bool(c->panel); });
+}
+
+cmp::StatsReply Compositor::stats() const {
+    cmp::StatsReply reply;
+    for (const auto& c : clients_) {
+        if (!c->panel || reply.count == cmp::MAX_CLIENTS) {
+            continue;
+        }
+        cmp::ClientStats& st = reply.clients[reply.count++];
+        cmp::copy_string(st.name, c->name);
+        st.panel = *c->panel;
+        c->latency.fill(st);
+    }
+    return reply;
+}
+
+void Compositor::print_clients(std::ostream& out) const {
+    const auto reply = stats();
+    for (uint32_t i = 0; i < reply.count; ++i) {
+        const auto& st = reply.clients[i];
+        out << std::left << std::setw(20) << st.name << std::right << " " << panel_name(st.panel)
+            << std::setw(8) << st.frames << " frames  latency " << std::fixed << std::setprecision(2)
+            << st.avg_us / 1000.0 << " / " << st.p95_us / 1000.0 << " / " << st.max_us / 1000.0 << " ms\n";
+    }
+}
+
+// Refuses to steal the socket of a compositord that is still running; a
+// stale socket file from one that died is replaced.
+int listen_on(const std::string& path) {
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            throw std::runtime_error(path + " exists and is not a socket");
+        }
+        bool live = false;
+        try {
+            close(cmp::connect_socket(path));
+            live = true;
+        } catch (const std::runtime_error&) {
+        }
+        if (live) {
+            throw std::runtime_error("a compositor is already listening on " + path);
+        }
+        unlink(path.c_str());
+    }
+
+    sockaddr_un addr{};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        throw std::invalid_argument("socket path too long: " + path);
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    const int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        throw std::runtime_error("socket failed: " + std::string(std::strerror(errno)));
+    }
+    // The daemon needs root for the GPIO lines; its clients should not.
+    if (bind(sock, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 ||
+        chmod(path.c_str(), 0666) < 0 || listen(sock, int(cmp::MAX_CLIENTS)) < 0) {
+        const int err = errno;
+        close(sock);
+        throw std::runtime_error("cannot listen on " + path + ": " + std::strerror(err));
+    }
+    return sock;
+}
+
+Task<> init_lcd(gc9::Gc9Panel& lcd) {
+    co_await lcd.init_async();
+    lcd.set_round_mode(true);
+}
+
+Task<> init_paper(epd::Epd29& paper) {
+    co_await paper.init_async();
+    co_await paper.clear_async();
+}
+
+// Completes on SIGINT or SIGTERM.
+Task<> wait_for_signal(int sfd) {
+    signalfd_siginfo info;
+    while (read(sfd, &info, sizeof(info)) != ssize_t(sizeof(info))) {
+        co_await pidisp::readable(sfd, FOREVER);
+    }
+    std::cout << "\nSignal " << info.ssi_signo << ", shutting down\n";
+}
+
+// Runs a task the daemon cannot live without. Whether it ends or fails, the
+// executor is stopped; a failure is kept for main to report.
+Task<> essential(Task<> task, pidisp::Executor& executor, std::exception_ptr& failure) {
+    try {
+        co_await task;
+    } catch (...) {
+        failure = std::current_exception();
+    }
+    executor.stop();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        bool v2 = false;
+        std::string socket_path = cmp::SOCKET_PATH;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--v2") {
+                v2 = true;
+            } else if (arg == "--socket" && i + 1 < argc) {
+                socket_path = argv[++i];
+            } else {
+                std::cerr << "usage: " << argv[0] << " [--v2] [--socket PATH]\n";
+                return 2;
+            }
+        }
+
+        // Signals arrive through a descriptor the executor can poll.
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, SIGINT);
+        sigaddset(&mask, SIGTERM);
+        sigprocmask(SIG_BLOCK, &mask, nullptr);
+        const int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (sfd < 0) {
+            throw std::runtime_error("signalfd failed: " + std::string(std::strerror(errno)));
+        }
+
+        pidisp::SpiBus bus;
+        gc9::Gc9Panel lcd(bus, {.cs = 7, .dc = 5, .rst = 6}, "/dev/gpiochip0",
+                          {gc9::SPI_PATH, uint8_t(gc9::SPI_MODE | SPI_NO_CS), GC9_SPEED_HZ, gc9::SPI_BITS});
+        const epd::Pins epd_pins{.dc = 25, .rst = 17, .busy = 24};
+        std::unique_ptr<epd::Epd29> paper = v2 ? std::make_unique<epd::Epd29V2>(bus, epd_pins)
+                                               : std::make_unique<epd::Epd29>(bus, epd_pins);
+
+        pidisp::Executor executor;
+        const auto init_start = std::chrono::steady_clock::now();
+        executor.spawn(init_lcd(lcd));
+        executor.spawn(init_paper(*paper));
+        executor.run();
+        paper->set_verbose(false);
+        std::cout << "Panels up in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() -
+                                                                           init_start)
+                         .count()
+                  << " ms\n";
+
+        lcd.fill_color(0x0000);
+        const int listener = listen_on(socket_path);
+        Compositor compositor(executor, lcd, *paper);
+        std::exception_ptr failure;
+        executor.spawn(essential(compositor.present_gc9(), executor, failure));
+        executor.spawn(essential(compositor.finish_gc9(), executor, failure));
+        executor.spawn(essential(compositor.present_epd(), executor, failure));
+        executor.spawn(essential(compositor.watch_epd_idle(), executor, failure));
+        executor.spawn(essential(compositor.accept_clients(listener), executor, failure));
+        executor.spawn(essential(wait_for_signal(sfd), executor, failure));
+        std::cout << "Listening on " << socket_path << "\n";
+        executor.run();
+
+        close(listener);
+        unlink(socket_path.c_str());
+        close(sfd);
+        compositor.print_clients(std::cout);
+        paper->deep_sleep();
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        std::cout << "Stopped.\n";
+    } catch (const std::exception& ex) {
+        std::cerr << "compositord failed: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
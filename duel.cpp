@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <linux/spi/spidev.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "epd29.hpp"
+#include "epd_ghosting.hpp"
+#include "gc9_panel.hpp"
+#include "mono_canvas.hpp"
+#include "spi_bus.hpp"
+#include "task.hpp"
+
+// Native version of duel_test.py: the GC9 stamps a random glyph in a random
+// colour every ~10 ms while the EPD shows one random glyph per partial
+// refresh every ~100 ms. Each panel has its own render thread and the two
+// share SPI through pidisp::SpiBus instead of one global lock. With --coop
+// both loops run as tasks on one pidisp::Executor instead, so the EPD's BUSY
+// waits and the frame pacing cost no thread at all.
+
+namespace {
+
+namespace gc9 = pidisp::gc9;
+namespace epd = pidisp::epd;
+
+// duel_test.py renders DejaVuSans at 90 px; the glyphs are drawn here as
+// shapes of about the same ink extent.
+constexpr int GLYPH_SIZE = 80;
+constexpr size_t GLYPH_STRIDE = (GLYPH_SIZE + 7) / 8;
+constexpr int GLYPH_COUNT = 5;  // star, heart, circle, sun, skull and crossbones
+
+// The GC9 sits on CE1's pin as a GPIO chip select, so it talks through
+// spidev0.0 with the hardware CS disabled while the EPD keeps CE0.
+constexpr uint32_t GC9_SPEED_HZ = 40'000'000;  // as in duel_test.py
+
+constexpr auto GC9_PERIOD = std::chrono::milliseconds(10);
+constexpr auto EPD_PERIOD = std::chrono::milliseconds(100);
+
+using GlyphMask = std::array<uint8_t, GLYPH_STRIDE * GLYPH_SIZE>;
+
+// Whether the point (u, v), both in [-1, 1] with v up, is ink in glyph `index`.
+bool glyph_ink(int index, double u, double v) {
+    constexpr double PI = 3.14159265358979323846;
+    const double r = std::hypot(u, v);
+    switch (index) {
+    case 0: {  // five-pointed star, even-odd test against its ten vertices
+        std::array<std::pair<double, double>, 10> pts;
+        for (int i = 0; i < 10; ++i) {
+            const double a = PI / 2 + i * PI / 5;
+            const double rad = i % 2 ? 0.4 : 1.0;
+            pts[i] = {rad * std::cos(a), rad * std::sin(a) - 0.1};
+        }
+        bool inside = false;
+        for (size_t i = 0, j = pts.size() - 1; i < pts.size(); j = i++) {
+            const auto [xi, yi] = pts[i];
+            const auto [xj, yj] = pts[j];
+            if ((yi > v) != (yj > v) && u < (xj - xi) * (v - yi) / (yj - yi) + xi) {
+                inside = !inside;
+            }
+        }
+        return inside;
+    }
+    case 1: {  // heart curve
+        const double x = u * 1.25;
+        const double y = v * 1.3 + 0.15;
+        const double k = x * x + y * y - 1;
+        return k * k * k - x * x * y * y * y <= 0;
+    }
+    case 2:
+        return r <= 0.75;
+    case 3: {  // disc plus eight rays
+        if (r <= 0.45) {
+            return true;
+        }
+        const double a = std::atan2(v, u);
+        const double off = std::abs(a - std::round(a / (PI / 4)) * (PI / 4));
+        return r >= 0.6 && r <= 0.98 && off * r <= 0.07;
+    }
+    default: {  // skull over crossed bones
+        const bool cranium = (u * u) / 0.42 + (v - 0.25) * (v - 0.25) / 0.36 <= 1;
+        const bool jaw = std::abs(u) <= 0.38 && v >= -0.5 && v <= 0.0;
+        const bool eye = std::hypot(std::abs(u) - 0.26, v - 0.15) <= 0.16;
+        const bool nose = v <= -0.05 && v >= -0.2 && std::abs(u) <= (v + 0.2) * 0.5;
+        if ((cranium || jaw) && !eye && !nose) {
+            return true;
+        }
+        const bool bone = (std::abs(u - v) <= 0.12 || std::abs(u + v) <= 0.12) && r <= 1.0;
+        return bone && v <= -0.1;
+    }
+    }
+}
+
+std::array<GlyphMask, GLYPH_COUNT> make_glyphs() {
+    std::array<GlyphMask, GLYPH_COUNT> glyphs{};
+    for (int g = 0; g < GLYPH_COUNT; ++g) {
+        pidisp::MonoCanvas canvas(glyphs[g].data(), GLYPH_SIZE, GLYPH_SIZE, GLYPH_STRIDE);
+        for (int y = 0; y < GLYPH_SIZE; ++y) {
+            for (int x = 0; x < GLYPH_SIZE; ++x) {
+                const double u = (x + 0.5) * 2 / GLYPH_SIZE - 1;
+                const double v = 1 - (y + 0.5) * 2 / GLYPH_SIZE;
+                canvas.set_pixel(x, y, glyph_ink(g, u, v));
+            }
+        }
+    }
+    return glyphs;
+}
+
+// One render loop's numbers. Only that loop writes them; main reads them
+// after it has finished.
+struct PanelMeter {
+    size_t frames = 0;
+    std::vector<double> latency_ms;  // render start to panel update done
+    std::exception_ptr error;
+};
+
+std::atomic<bool> running{true};
+
+void on_sigint(int) { running = false; }
+
+// The render loops are tasks either way: run with get() on their own thread
+// the delays are plain sleeps, spawned on an Executor they interleave.
+pidisp::Task<> gc9_loop(gc9::Gc9Panel& panel, const std::array<GlyphMask, GLYPH_COUNT>& glyphs,
+                        PanelMeter& meter) {
+    try {
+        std::mt19937 rng(std::random_device{}());
+        std::vector<uint16_t> frame(size_t(gc9::PANEL_WIDTH) * gc9::PANEL_HEIGHT, 0x0000);
+        while (running) {
+            const auto start = std::chrono::steady_clock::now();
+            const int x0 = std::uniform_int_distribution<int>(0, gc9::PANEL_WIDTH - 100)(rng);
+            const int y0 = std::uniform_int_distribution<int>(0, gc9::PANEL_HEIGHT - 100)(rng);
+            const GlyphMask& glyph = glyphs[rng() % GLYPH_COUNT];
+            const uint32_t rgb = rng();
+            const uint16_t color = ((rgb >> 8) & 0xF800) | ((rgb >> 5) & 0x07E0) | ((rgb >> 3) & 0x001F);
+
+            // Glyphs accumulate, as on the Python side's persistent image.
+            for (int y = 0; y < GLYPH_SIZE; ++y) {
+                for (int x = 0; x < GLYPH_SIZE; ++x) {
+                    if (glyph[y * GLYPH_STRIDE + x / 8] & (0x80 >> (x % 8))) {
+                        frame[size_t(y0 + y) * gc9::PANEL_WIDTH + x0 + x] = color;
+                    }
+                }
+            }
+            panel.present(frame.data());
+
+            meter.latency_ms.push_back(std::chrono::duration<double, std::milli>(
+                                           std::chrono::steady_clock::now() - start)
+                                           .count());
+            ++meter.frames;
+            co_await pidisp::delay(GC9_PERIOD);
+        }
+    } catch (...) {
+        meter.error = std::current_exception();
+        running = false;
+    }
+}
+
+// Partial refreshes, promoted to full ones by `ghosting` where the glass has
+// taken too many. The loop never idles, so there are no idle cleanups.
+pidisp::Task<> epd_loop(epd::Epd29& panel, epd::GhostingScheduler& ghosting,
+                        const std::array<GlyphMask, GLYPH_COUNT>& glyphs, PanelMeter& meter) {
+    try {
+        std::mt19937 rng(std::random_device{}());
+        static const GlyphMask black{};
+        epd::Frame frame;
+        while (running) {
+            const auto start = std::chrono::steady_clock::now();
+            frame.fill(0xFF);
+            pidisp::MonoCanvas canvas(frame.data(), epd::PANEL_WIDTH, epd::PANEL_HEIGHT);
+            const int x = std::uniform_int_distribution<int>(0, epd::PANEL_WIDTH - 40)(rng);
+            const int y = std::uniform_int_distribution<int>(0, epd::PANEL_HEIGHT - 40)(rng);
+            canvas.blit(x, y, black.data(), GLYPH_STRIDE, GLYPH_SIZE, GLYPH_SIZE,
+                        glyphs[rng() % GLYPH_COUNT].data());
+            co_await epd::display_scheduled(panel, ghosting, frame, epd::Refresh::PARTIAL);
+
+            meter.latency_ms.push_back(std::chrono::duration<double, std::milli>(
+                                           std::chrono::steady_clock::now() - start)
+                                           .count());
+            ++meter.frames;
+            co_await pidisp::delay(EPD_PERIOD);
+        }
+    } catch (...) {
+        meter.error = std::current_exception();
+        running = false;
+    }
+}
+
+// Ends the run after `seconds` (0: only on CTRL+C or a failed loop).
+pidisp::Task<> stop_after(double seconds) {
+    const auto stop_at = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while (running && (seconds <= 0 || std::chrono::steady_clock::now() < stop_at)) {
+        co_await pidisp::delay(std::chrono::milliseconds(50));
+    }
+    running = false;
+}
+
+pidisp::Task<> init_lcd(gc9::Gc9Panel& lcd) {
+    co_await lcd.init_async();
+    lcd.set_round_mode(true);  // the corners are off the glass anyway
+}
+
+pidisp::Task<> init_paper(epd::Epd29& paper) {
+    co_await paper.init_async();
+    co_await paper.clear_async();
+}
+
+void report(const char* name, PanelMeter& meter, const pidisp::BusClientStats& bus, size_t bytes,
+            double seconds) {
+    auto& lat = meter.latency_ms;
+    std::sort(lat.begin(), lat.end());
+    double avg = 0;
+    for (double ms : lat) {
+        avg += ms;
+    }
+    avg = lat.empty() ? 0 : avg / lat.size();
+    const double p95 = lat.empty() ? 0 : lat[std::min(lat.size() - 1, lat.size() * 95 / 100)];
+    const double worst = lat.empty() ? 0 : lat.back();
+    const double busy = bus.hold_total.count() / 1e6 / seconds * 100;
+
+    std::cout << std::left << std::setw(5) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(7) << meter.frames / seconds << " fps  latency " << std::setprecision(2) << avg
+              << " / " << p95 << " / " << worst << " ms  bus " << std::setprecision(1) << busy << "% ("
+              << bytes / seconds / 1024 << " KiB/s), wait max " << bus.wait_max.count() / 1000.0
+              << " ms\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    try {
+        bool v2 = false;
+        bool coop = false;
+        double measure_s = 0;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--v2") {
+                v2 = true;
+            } else if (arg == "--coop") {
+                coop = true;
+            } else if (arg == "--measure" && i + 1 < argc) {
+                measure_s = std::stod(argv[++i]);
+            } else {
+                std::cerr << "usage: " << argv[0] << " [--v2] [--coop] [--measure SECONDS]\n";
+                return 2;
+            }
+        }
+
+        const auto glyphs = make_glyphs();
+        pidisp::SpiBus bus;
+
+        gc9::Gc9Panel lcd(bus, {.cs = 7, .dc = 5, .rst = 6}, "/dev/gpiochip0",
+                          {gc9::SPI_PATH, uint8_t(gc9::SPI_MODE | SPI_NO_CS), GC9_SPEED_HZ, gc9::SPI_BITS});
+        const epd::Pins epd_pins{.dc = 25, .rst = 17, .busy = 24};
+        std::unique_ptr<epd::Epd29> paper = v2 ? std::make_unique<epd::Epd29V2>(bus, epd_pins)
+                                               : std::make_unique<epd::Epd29>(bus, epd_pins);
+
+        if (coop) {
+            // The LCD is up long before the EPD's reset and clear finish.
+            pidisp::Executor init;
+            init.spawn(init_lcd(lcd));
+            init.spawn(init_paper(*paper));
+            init.run();
+        } else {
+            init_lcd(lcd).get();
+            init_paper(*paper).get();
+        }
+        paper->set_verbose(false);
+
+        std::signal(SIGINT, on_sigint);
+        if (measure_s > 0) {
+            std::cout << "Measuring for " << measure_s << " s...\n";
+        } else {
+            std::cout << "Dual display running. CTRL+C to quit.\n";
+        }
+
+        const auto lcd_bus = lcd.bus_client().stats();
+        const auto paper_bus = paper->bus_client().stats();
+        const size_t lcd_bytes = lcd.stats().bytes;
+        const size_t paper_bytes = paper->stats().bytes;
+        const size_t mode_ioctls = bus.config_ioctls();
+
+        const auto start = std::chrono::steady_clock::now();
+        PanelMeter lcd_meter;
+        PanelMeter paper_meter;
+        epd::GhostingScheduler ghosting;
+        pidisp::Executor executor;
+        if (coop) {
+            executor.spawn(gc9_loop(lcd, glyphs, lcd_meter));
+            executor.spawn(epd_loop(*paper, ghosting, glyphs, paper_meter));
+            executor.spawn(stop_after(measure_s));
+            executor.run();
+        } else {
+            std::thread lcd_thread([&] { gc9_loop(lcd, glyphs, lcd_meter).get(); });
+            std::thread paper_thread([&] { epd_loop(*paper, ghosting, glyphs, paper_meter).get(); });
+            stop_after(measure_s).get();
+            lcd_thread.join();
+            paper_thread.join();
+        }
+        const double seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for (const auto& error : {lcd_meter.error, paper_meter.error}) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        if (measure_s > 0) {
+            // Counters since the loops started: bus hold time and bytes exclude init.
+            auto lcd_now = lcd.bus_client().stats();
+            auto paper_now = paper->bus_client().stats();
+            lcd_now.hold_total -= lcd_bus.hold_total;
+            paper_now.hold_total -= paper_bus.hold_total;
+            std::cout << "Over " << std::fixed << std::setprecision(1) << seconds
+                      << " s (latency avg / p95 / max):\n";
+            report("gc9", lcd_meter, lcd_now, lcd.stats().bytes - lcd_bytes, seconds);
+            report("epd", paper_meter, paper_now, paper->stats().bytes - paper_bytes, seconds);
+            std::cout << "SPI busy " << std::setprecision(1)
+                      << (lcd_now.hold_total + paper_now.hold_total).count() / 1e6 / seconds * 100
+                      << "% of wall time, " << bus.config_ioctls() - mode_ioctls << " mode switches\n";
+            const auto wear = ghosting.counters();
+            std::cout << "EPD ghosting: " << wear.partial << " partial, " << wear.full_forced
+                      << " promoted to full\n";
+            if (coop) {
+                std::cout << "Executor idle " << executor.stats().idle.count() / 1e6 / seconds * 100
+                          << "% of wall time, " << executor.stats().resumes << " resumes\n";
+            }
+        }
+
+        paper->deep_sleep();
+        std::cout << "Stopped.\n";
+    } catch (const std::exception& ex) {
+        std::cerr << "Duel failed: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,776 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <linux/spi/spidev.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <gpiod.hpp>
+
+#include "busy_line.hpp"
+#include "mono_canvas.hpp"
+#include "mono_convert.hpp"
+#include "panel_init.hpp"
+#include "spi_bus.hpp"
+#include "spi_transfer.hpp"
+
+// 2.9" 128x296 e-paper panel: UC8151 (Epd29) and SSD1680 (Epd29V2)
+// controllers behind one interface, with partial and 4-gray refreshes.
+namespace pidisp::epd {
+
+constexpr char SPI_PATH[] = "/dev/spidev0.0";  // CE0 -> panel CS
+constexpr uint32_t SPI_SPEED_HZ = 4'000'000;
+constexpr uint8_t SPI_BITS = 8;
+constexpr uint8_t SPI_MODE = SPI_MODE_0;
+// A refresh takes hundreds of milliseconds anyway, so bus requests can wait
+// behind animated panels. Plane uploads go out in chunks of UPLOAD_CHUNK
+// bytes (about 2 ms at SPI_SPEED_HZ), yielding the bus in between.
+constexpr std::chrono::milliseconds BUS_DEADLINE{500};
+constexpr size_t UPLOAD_CHUNK = 1024;
+
+constexpr int PANEL_WIDTH = 128;
+constexpr int PANEL_HEIGHT = 296;
+constexpr int ROW_BYTES = PANEL_WIDTH / 8;
+constexpr size_t BUFFER_SIZE = (PANEL_WIDTH * PANEL_HEIGHT) / 8;
+constexpr bool BUSY_ACTIVE_HIGH = true;  // module keeps BUSY high while processing
+
+constexpr std::array EPD_INIT{
+    init_cmd(0x06, {0x17, 0x17, 0x17}),  // booster soft start
+    init_cmd_wait_busy(0x04, "power on"),
+    init_cmd(0x00, {0x0F}),  // panel settings (KW-BF, BWROTP)
+    init_cmd(0x50, {0xF7}),  // VCOM / data interval
+    init_cmd(0x30, {0x3C}),  // PLL control
+    init_cmd(0x61, {PANEL_WIDTH >> 8, PANEL_WIDTH & 0xFF,  // resolution (X, Y)
+                            PANEL_HEIGHT >> 8, PANEL_HEIGHT & 0xFF}),
+    init_cmd(0x82, {0x12}),  // VCOM voltage
+};
+static_assert(valid_init(EPD_INIT, {{0x06, 3}, {0x04, 0}, {0x00, 1}, {0x50, 1}, {0x30, 1},
+                                    {0x61, 4}, {0x82, 1}}));
+
+// Partial updates drive the panel from register LUTs (PSR REG_EN) instead of
+// the OTP waveforms, with a faster frame rate. Switching back to full refresh
+// restores the init values.
+constexpr std::array EPD_PARTIAL_MODE{
+    init_cmd(0x00, {0x2F}),  // panel settings, LUT from register
+    init_cmd(0x30, {0x3A}),  // PLL 100 Hz
+    init_cmd(0x50, {0x97}),  // VCOM / data interval
+};
+constexpr std::array EPD_FULL_MODE{
+    init_cmd(0x00, {0x0F}),
+    init_cmd(0x30, {0x3C}),
+    init_cmd(0x50, {0xF7}),
+};
+static_assert(valid_init(EPD_PARTIAL_MODE, {{0x00, 1}, {0x30, 1}, {0x50, 1}}));
+static_assert(valid_init(EPD_FULL_MODE, {{0x00, 1}, {0x30, 1}, {0x50, 1}}));
+
+// Single-phase fast waveform (Waveshare epd2in9d): `level` selects the drive
+// for the transition, held for 0x19 frames, one repeat.
+template <size_t N>
+constexpr std::array<uint8_t, N> partial_lut(uint8_t level) {
+    std::array<uint8_t, N> lut{};
+    lut[0] = level;
+    lut[1] = 0x19;
+    lut[2] = 0x01;
+    lut[5] = 0x01;
+    return lut;
+}
+
+constexpr auto LUT_VCOM_PARTIAL = partial_lut<44>(0x00);
+constexpr auto LUT_WW_PARTIAL = partial_lut<42>(0x00);
+constexpr auto LUT_BW_PARTIAL = partial_lut<42>(0x80);
+constexpr auto LUT_WB_PARTIAL = partial_lut<42>(0x40);
+constexpr auto LUT_BB_PARTIAL = partial_lut<42>(0x00);
+
+// 4-level gray: the old-data plane carries the high bit of each pixel and the
+// new-data plane the low bit, and the register LUTs drive each of the four
+// (old, new) pairs to its own level. Waveforms from Waveshare's UC8176 4-gray
+// driver; gray levels depend on the panel and may need tuning.
+template <size_t N>
+constexpr std::array<uint8_t, N> lut_table(std::initializer_list<uint8_t> rows) {
+    if (rows.size() > N) {
+        throw std::logic_error("LUT table too long");
+    }
+    std::array<uint8_t, N> lut{};
+    size_t i = 0;
+    for (uint8_t byte : rows) {
+        lut[i++] = byte;
+    }
+    return lut;
+}
+
+constexpr std::array EPD_GRAY4_MODE{
+    init_cmd(0x00, {0x2F}),  // panel settings, LUT from register
+    init_cmd(0x30, {0x3C}),  // PLL 50 Hz
+    init_cmd(0x50, {0x97}),
+};
+static_assert(valid_init(EPD_GRAY4_MODE, {{0x00, 1}, {0x30, 1}, {0x50, 1}}));
+
+constexpr auto LUT_VCOM_GRAY4 = lut_table<44>({
+    0x00, 0x0A, 0x00, 0x00, 0x00, 0x01, 0x60, 0x14, 0x14, 0x00, 0x00, 0x01,
+    0x00, 0x14, 0x00, 0x00, 0x00, 0x01, 0x00, 0x13, 0x0A, 0x01, 0x00, 0x01,
+});
+constexpr auto LUT_WW_GRAY4 = lut_table<42>({  // old 1, new 1: white
+    0x40, 0x0A, 0x00, 0x00, 0x00, 0x01, 0x90, 0x14, 0x14, 0x00, 0x00, 0x01,
+    0x10, 0x14, 0x0A, 0x00, 0x00, 0x01, 0xA0, 0x13, 0x01, 0x00, 0x00, 0x01,
+});
+constexpr auto LUT_BW_GRAY4 = lut_table<42>({  // old 0, new 1: dark gray
+    0x40, 0x0A, 0x00, 0x00, 0x00, 0x01, 0x90, 0x14, 0x14, 0x00, 0x00, 0x01,
+    0x00, 0x14, 0x0A, 0x00, 0x00, 0x01, 0x99, 0x0C, 0x01, 0x03, 0x04, 0x01,
+    0x02, 0x0B, 0x03, 0x00, 0x00, 0x01,
+});
+constexpr auto LUT_WB_GRAY4 = lut_table<42>({  // old 1, new 0: light gray
+    0x40, 0x0A, 0x00, 0x00, 0x00, 0x01, 0x90, 0x14, 0x14, 0x00, 0x00, 0x01,
+    0x00, 0x14, 0x0A, 0x00, 0x00, 0x01, 0x99, 0x0B, 0x04, 0x04, 0x01, 0x01,
+});
+constexpr auto LUT_BB_GRAY4 = lut_table<42>({  // old 0, new 0: black
+    0x80, 0x0A, 0x00, 0x00, 0x00, 0x01, 0x90, 0x14, 0x14, 0x00, 0x00, 0x01,
+    0x20, 0x14, 0x0A, 0x00, 0x00, 0x01, 0x50, 0x13, 0x01, 0x00, 0x00, 0x01,
+});
+
+using Frame = std::array<uint8_t, BUFFER_SIZE>;
+using GrayFrame = std::array<uint8_t, BUFFER_SIZE * 2>;  // packed 2bpp, see split_gray4()
+
+enum class Refresh { FULL, PARTIAL, GRAY4 };
+
+// SSD1680 (Waveshare 2.9" V2). RAM is addressed in bytes on X and rows on Y,
+// with 0x24 holding the new image and 0x26 the base image a partial
+// waveform compares against.
+constexpr std::array SSD1680_INIT{
+    init_cmd_wait_busy(0x12, "software reset"),
+    init_cmd(0x01, {(PANEL_HEIGHT - 1) & 0xFF, (PANEL_HEIGHT - 1) >> 8, 0x00}),  // gate lines
+    init_cmd(0x11, {0x03}),                    // data entry: X then Y increment
+    init_cmd(0x44, {0x00, ROW_BYTES - 1}),     // RAM X window (bytes)
+    init_cmd(0x45, {0x00, 0x00, (PANEL_HEIGHT - 1) & 0xFF, (PANEL_HEIGHT - 1) >> 8}),
+    init_cmd(0x3C, {0x05}),                    // border waveform
+    init_cmd(0x21, {0x00, 0x80}),              // display update control
+    init_cmd(0x18, {0x80}),                    // internal temperature sensor
+    init_cmd(0x4E, {0x00}),                    // RAM X counter
+    init_cmd(0x4F, {0x00, 0x00}),              // RAM Y counter
+};
+static_assert(valid_init(SSD1680_INIT, {{0x12, 0}, {0x01, 3}, {0x11, 1}, {0x44, 2}, {0x45, 4},
+                                        {0x3C, 1}, {0x21, 2}, {0x18, 1}, {0x4E, 1}, {0x4F, 2}}));
+
+// Waveshare's WF_PARTIAL_2IN9: 153 bytes of phase table for 0x32, then the
+// gate level (0x3F), gate voltage (0x03), three source voltages (0x04) and
+// VCOM (0x2C).
+constexpr std::array<uint8_t, 159> SSD1680_PARTIAL_LUT{
+    0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // VS L0
+    0x80, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // VS L1
+    0x40, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // VS L2
+    0x00, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // VS L3
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // VS L4
+    0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02,  // group 0 timing
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  // group 11
+    0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x00, 0x00, 0x00,  // frame rate, XON
+    0x22, 0x17, 0x41, 0xB0, 0x32, 0x36,  // EOPT, VGH, VSH1, VSH2, VSL, VCOM
+};
+
+// Byte-aligned window of changed pixels, inclusive, in panel pixels.
+struct DirtyBox {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = -1;
+    int y1 = -1;
+
+    bool empty() const { return x1 < x0; }
+    size_t bytes() const { return empty() ? 0 : size_t((x1 - x0 + 1) / 8) * (y1 - y0 + 1); }
+};
+
+// Scans two frames a 64-bit word at a time: rows that XOR to zero are skipped,
+// and the XOR of every changed row is ORed into a column mask from which the
+// horizontal extent is read once at the end.
+//
+// A single box is deliberate: every partial window needs its own refresh
+// cycle on this controller, which costs far more than the extra bytes of the
+// union.
+inline DirtyBox diff_box(const Frame& prev, const Frame& next) {
+    static_assert(ROW_BYTES % sizeof(uint64_t) == 0);
+    constexpr int WORDS = ROW_BYTES / sizeof(uint64_t);
+
+    std::array<uint64_t, WORDS> columns{};
+    DirtyBox box;
+    bool found = false;
+    for (int y = 0; y < PANEL_HEIGHT; ++y) {
+        uint64_t changed = 0;
+        for (int w = 0; w < WORDS; ++w) {
+            uint64_t a;
+            uint64_t b;
+            std::memcpy(&a, prev.data() + y * ROW_BYTES + w * 8, 8);
+            std::memcpy(&b, next.data() + y * ROW_BYTES + w * 8, 8);
+            columns[w] |= a ^ b;
+            changed |= a ^ b;
+        }
+        if (changed) {
+            if (!found) {
+                box.y0 = y;
+                found = true;
+            }
+            box.y1 = y;
+        }
+    }
+    if (!found) {
+        return {};
+    }
+
+    std::array<uint8_t, ROW_BYTES> column_bytes;
+    std::memcpy(column_bytes.data(), columns.data(), ROW_BYTES);
+    int first = 0;
+    while (!column_bytes[first]) {
+        ++first;
+    }
+    int last = ROW_BYTES - 1;
+    while (!column_bytes[last]) {
+        --last;
+    }
+    box.x0 = first * 8;
+    box.x1 = last * 8 + 7;
+    return box;
+}
+
+// What the last display() call did on the wire.
+struct UpdateReport {
+    Refresh mode = Refresh::FULL;
+    DirtyBox box;
+    size_t spi_bytes = 0;
+    std::chrono::microseconds diff_time{};
+    size_t coalesced = 0;  // later submissions folded into this refresh (AsyncEpd)
+};
+
+struct RefreshStats {
+    size_t count = 0;
+    size_t skipped = 0;  // partial updates with nothing changed
+    std::chrono::milliseconds last{};
+    std::chrono::milliseconds total{};
+};
+
+struct Pins {
+    unsigned int dc;
+    unsigned int rst;
+    unsigned int busy;
+};
+
+// 2.9" 128x296 panel on a UC8151-class controller. Frame bookkeeping (the
+// old plane, damage boxes, refresh stats) lives here. The controller-specific
+// command sequences are virtual, so other controllers (Epd29V2) reuse the
+// same interface.
+class Epd29 {
+public:
+    // `spi` overrides the SPI_* defaults, as for Gc9Panel, e.g. to run the
+    // panel at another clock.
+    Epd29(SpiBus& bus, Pins pins, const std::string& chip = "/dev/gpiochip0",
+          SpiDeviceConfig spi = {SPI_PATH, SPI_MODE, SPI_SPEED_HZ, SPI_BITS})
+        : pins_(pins), chip_(chip), bus_(bus.attach("epd", std::move(spi), BUS_DEADLINE)) {
+        planner_.set_clock(bus_.config().speed_hz, bus_.config().bits);
+        last_frame_.fill(0xFF);
+    }
+
+    virtual ~Epd29() = default;
+
+    void init() { init_async().get(); }
+    void clear() { clear_async().get(); }
+    void demo_pattern();
+    void deep_sleep() { deep_sleep_async().get(); }
+
+    // Sends `frame` as the new plane and the previously displayed frame as the
+    // old one, then refreshes with the requested waveform. Partial updates only
+    // send the bounding box of changed pixels, and are skipped when nothing
+    // changed.
+    void display(const Frame& frame, Refresh mode) { display_async(frame, mode).get(); }
+    // The same with the damage already known: `box` must be
+    // diff_box(last_frame(), frame), e.g. from a caller that needed it to
+    // choose `mode`. last_update().diff_time is then left at zero.
+    void display(const Frame& frame, Refresh mode, const DirtyBox& box) {
+        display_async(frame, mode, box).get();
+    }
+
+    // Full refresh with the 4-level waveform. What follows a gray image must
+    // be a full refresh, so the next PARTIAL display() is promoted to FULL.
+    void display_gray(const GrayFrame& frame) { display_gray_async(frame).get(); }
+
+    // The same operations as tasks for an Executor: resets and BUSY waits are
+    // awaited rather than slept through. `frame` must outlive the task.
+    Task<> init_async();
+    Task<> clear_async();
+    Task<> deep_sleep_async();
+    Task<> display_async(const Frame& frame, Refresh mode) { return update(frame, mode, std::nullopt); }
+    Task<> display_async(const Frame& frame, Refresh mode, const DirtyBox& box) {
+        return update(frame, mode, box);
+    }
+    Task<> display_gray_async(const GrayFrame& frame);
+    const UpdateReport& last_update() const { return last_update_; }
+    const Frame& last_frame() const { return last_frame_; }
+
+    const SpiStats& stats() const { return stats_; }
+    const RefreshStats& refresh_stats(Refresh mode) const {
+        return refresh_stats_[static_cast<size_t>(mode)];
+    }
+    const TransferPlanner& planner() const { return planner_; }
+    const InitReport& init_report() const { return init_report_; }
+    const SpiBus::Client& bus_client() const { return bus_; }
+
+    // Logs every BUSY wait with its duration when on (the default).
+    void set_verbose(bool on) { verbose_ = on; }
+
+protected:
+    // Controller hooks. The refresh_* calls send whatever the controller
+    // needs for `frame` (last_frame_ still holds what is on the glass), start
+    // the update and return the BUSY time.
+    virtual Task<> init_controller();
+    virtual Task<> set_refresh_mode(Refresh mode);
+    virtual Task<std::chrono::milliseconds> refresh_full(const Frame& frame);
+    virtual Task<std::chrono::milliseconds> refresh_partial(const Frame& frame, const DirtyBox& box);
+    virtual Task<std::chrono::milliseconds> refresh_gray(const Frame& hi, const Frame& lo);
+    virtual Task<> power_down();
+
+    // `stage` is taken by value: the task may outlive the caller's string.
+    Task<std::chrono::milliseconds> wait_busy(std::string stage,
+                                              std::chrono::milliseconds poll = std::chrono::milliseconds(20));
+    void submit();
+    void send_cmd(uint8_t cmd);
+    void send_data(uint8_t byte);
+    // Sends whatever is queued, then `cmd` with `len` bytes of data in
+    // UPLOAD_CHUNK pieces, letting waiting bus clients in between pieces.
+    void upload(uint8_t cmd, const uint8_t* data, size_t len);
+
+    // Copies the byte-aligned window of `box` from both frames into
+    // old_window_ and new_window_.
+    void gather_window(const Frame& frame, const DirtyBox& box);
+
+    SpiTransaction txn_;
+    SpiStats stats_;
+    InitReport init_report_;
+    Refresh refresh_mode_ = Refresh::FULL;
+    Frame last_frame_;
+    std::vector<uint8_t> old_window_;
+    std::vector<uint8_t> new_window_;
+
+private:
+    Task<> update(const Frame& frame, Refresh mode, std::optional<DirtyBox> box);
+    void request_lines();
+    Task<> reset();
+    void set_dc(bool dc);
+
+    Pins pins_;
+    std::string chip_;
+    std::optional<gpiod::line_request> request_;
+    std::optional<BusyLine> busy_;
+    SpiBus::Client& bus_;
+
+    TransferPlanner planner_;
+    int dc_level_ = -1;
+
+    std::array<RefreshStats, 3> refresh_stats_;
+    bool gray_on_glass_ = false;
+    bool verbose_ = true;
+    UpdateReport last_update_;
+};
+
+inline void Epd29::request_lines() {
+    gpiod::chip chip(chip_);
+
+    gpiod::line_settings dc_settings;
+    dc_settings.set_direction(gpiod::line::direction::OUTPUT);
+    dc_settings.set_output_value(gpiod::line::value::INACTIVE);
+
+    gpiod::line_settings rst_settings = dc_settings;
+    rst_settings.set_output_value(gpiod::line::value::ACTIVE);
+
+    // Prefer edge detection on BUSY; some GPIO controllers cannot do it, in
+    // which case wait_busy() falls back to polling.
+    for (bool edges : {true, false}) {
+        gpiod::line_config lcfg;
+        lcfg.add_line_settings(pins_.dc, dc_settings);
+        lcfg.add_line_settings(pins_.rst, rst_settings);
+        lcfg.add_line_settings(pins_.busy, BusyLine::settings(edges));
+
+        auto builder = chip.prepare_request();
+        builder.set_consumer("epd-demo");
+        builder.set_line_config(lcfg);
+        try {
+            request_ = builder.do_request();
+        } catch (const std::system_error&) {
+            if (!edges) {
+                throw;
+            }
+            continue;
+        }
+        busy_.emplace(*request_, pins_.busy, BUSY_ACTIVE_HIGH, edges);
+        return;
+    }
+}
+
+inline Task<> Epd29::reset() {
+    if (!request_) {
+        throw std::runtime_error("lines not requested");
+    }
+
+    request_->set_value(pins_.rst, gpiod::line::value::ACTIVE);
+    co_await delay(std::chrono::milliseconds(10));
+    request_->set_value(pins_.rst, gpiod::line::value::INACTIVE);
+    co_await delay(std::chrono::milliseconds(10));
+    request_->set_value(pins_.rst, gpiod::line::value::ACTIVE);
+    co_await delay(std::chrono::milliseconds(120));
+}
+
+inline Task<std::chrono::milliseconds> Epd29::wait_busy(std::string stage, std::chrono::milliseconds poll) {
+    if (!busy_) {
+        throw std::runtime_error("lines not requested");
+    }
+
+    std::chrono::milliseconds elapsed;
+    try {
+        elapsed = co_await busy_->wait_release_async(std::chrono::seconds(20), poll);
+    } catch (const std::runtime_error& ex) {
+        throw std::runtime_error(stage + ": " + ex.what());
+    }
+
+    if (verbose_ && !stage.empty()) {
+        std::cout << stage << " complete in " << elapsed.count() << " ms ("
+                  << (busy_->edge_driven() ? "edge" : "poll") << ")\n";
+    }
+    co_return elapsed;
+}
+
+inline void Epd29::set_dc(bool dc) {
+    if (dc_level_ == dc) {
+        return;
+    }
+    request_->set_value(pins_.dc, dc ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+    dc_level_ = dc;
+    ++stats_.gpio_ioctls;
+}
+
+// CS is driven by spidev per message, so the bus is only held for the
+// transfer itself and never across a BUSY wait.
+inline void Epd29::submit() {
+    auto lease = bus_.acquire();
+    txn_.submit(bus_.fd(), planner_, [this](bool dc, bool) { set_dc(dc); }, stats_);
+}
+
+inline void Epd29::send_cmd(uint8_t cmd) {
+    auto lease = bus_.acquire();
+    set_dc(false);
+    planner_.write(bus_.fd(), &cmd, 1, stats_);
+}
+
+inline void Epd29::send_data(uint8_t byte) {
+    auto lease = bus_.acquire();
+    set_dc(true);
+    planner_.write(bus_.fd(), &byte, 1, stats_);
+}
+
+inline void Epd29::upload(uint8_t cmd, const uint8_t* data, size_t len) {
+    auto lease = bus_.acquire();
+    txn_.command(cmd);
+    for (size_t done = 0; done < len; done += UPLOAD_CHUNK) {
+        txn_.data_ref(data + done, std::min(UPLOAD_CHUNK, len - done));
+        submit();
+        lease.yield();
+    }
+    if (!len) {
+        submit();
+    }
+}
+
+inline Task<> Epd29::init_async() {
+    request_lines();
+
+    co_await reset();
+    co_await init_controller();
+    refresh_mode_ = Refresh::FULL;
+}
+
+inline Task<> Epd29::init_controller() {
+    init_report_ = co_await run_init(
+        EPD_INIT, txn_, stats_, [this] { submit(); },
+        [this](const char* stage) { return wait_busy(stage); });
+}
+
+inline Task<> Epd29::set_refresh_mode(Refresh mode) {
+    if (mode == refresh_mode_) {
+        co_return;
+    }
+
+    const auto no_busy = [](const char*) -> Task<> { co_return; };
+    if (mode == Refresh::PARTIAL) {
+        co_await run_init(EPD_PARTIAL_MODE, txn_, stats_, [this] { submit(); }, no_busy);
+        txn_.command(0x20, LUT_VCOM_PARTIAL.data(), LUT_VCOM_PARTIAL.size())
+            .command(0x21, LUT_WW_PARTIAL.data(), LUT_WW_PARTIAL.size())
+            .command(0x22, LUT_BW_PARTIAL.data(), LUT_BW_PARTIAL.size())
+            .command(0x23, LUT_WB_PARTIAL.data(), LUT_WB_PARTIAL.size())
+            .command(0x24, LUT_BB_PARTIAL.data(), LUT_BB_PARTIAL.size());
+        submit();
+    } else if (mode == Refresh::GRAY4) {
+        co_await run_init(EPD_GRAY4_MODE, txn_, stats_, [this] { submit(); }, no_busy);
+        txn_.command(0x20, LUT_VCOM_GRAY4.data(), LUT_VCOM_GRAY4.size())
+            .command(0x21, LUT_WW_GRAY4.data(), LUT_WW_GRAY4.size())
+            .command(0x22, LUT_BW_GRAY4.data(), LUT_BW_GRAY4.size())
+            .command(0x23, LUT_WB_GRAY4.data(), LUT_WB_GRAY4.size())
+            .command(0x24, LUT_BB_GRAY4.data(), LUT_BB_GRAY4.size());
+        submit();
+    } else {
+        co_await run_init(EPD_FULL_MODE, txn_, stats_, [this] { submit(); }, no_busy);
+    }
+    refresh_mode_ = mode;
+}
+
+inline void Epd29::gather_window(const Frame& frame, const DirtyBox& box) {
+    const int bx0 = box.x0 / 8;
+    const size_t width = box.x1 / 8 - bx0 + 1;
+
+    old_window_.clear();
+    new_window_.clear();
+    for (int y = box.y0; y <= box.y1; ++y) {
+        const size_t row = size_t(y) * ROW_BYTES + bx0;
+        old_window_.insert(old_window_.end(), last_frame_.begin() + row, last_frame_.begin() + row + width);
+        new_window_.insert(new_window_.end(), frame.begin() + row, frame.begin() + row + width);
+    }
+}
+
+inline Task<std::chrono::milliseconds> Epd29::refresh_full(const Frame& frame) {
+    upload(0x10, last_frame_.data(), last_frame_.size());
+    upload(0x13, frame.data(), frame.size());
+    txn_.command(0x12);
+    submit();
+    co_return co_await wait_busy("full refresh");
+}
+
+// Only the window's bytes of each plane are sent.
+inline Task<std::chrono::milliseconds> Epd29::refresh_partial(const Frame& frame, const DirtyBox& box) {
+    gather_window(frame, box);
+
+    const uint8_t hs = box.x0 / 8 * 8;
+    const uint8_t he = box.x1 / 8 * 8 + 7;
+    const int y0 = box.y0;
+    const int y1 = box.y1;
+    txn_.command(0x91)  // partial in
+        .command(0x90, {hs, he, uint8_t(y0 >> 8), uint8_t(y0 & 0xFF), uint8_t(y1 >> 8),
+                        uint8_t(y1 & 0xFF), 0x28});
+    upload(0x10, old_window_.data(), old_window_.size());
+    upload(0x13, new_window_.data(), new_window_.size());
+    txn_.command(0x12);
+    submit();
+    const auto elapsed = co_await wait_busy("partial refresh");
+    txn_.command(0x92);  // partial out
+    submit();
+    co_return elapsed;
+}
+
+inline Task<std::chrono::milliseconds> Epd29::refresh_gray(const Frame& hi, const Frame& lo) {
+    upload(0x10, hi.data(), hi.size());
+    upload(0x13, lo.data(), lo.size());
+    txn_.command(0x12);
+    submit();
+    co_return co_await wait_busy("gray refresh");
+}
+
+inline Task<> Epd29::update(const Frame& frame, Refresh mode, std::optional<DirtyBox> box) {
+    if (mode == Refresh::GRAY4) {
+        throw std::invalid_argument("GRAY4 frames go through display_gray()");
+    }
+    if (gray_on_glass_) {
+        mode = Refresh::FULL;
+    }
+
+    auto& rs = refresh_stats_[static_cast<size_t>(mode)];
+    const size_t bytes_before = stats_.bytes;
+    last_update_ = {};
+    last_update_.mode = mode;
+
+    if (mode == Refresh::PARTIAL) {
+        if (box) {
+            last_update_.box = *box;
+        } else {
+            const auto start = std::chrono::steady_clock::now();
+            last_update_.box = diff_box(last_frame_, frame);
+            last_update_.diff_time = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start);
+        }
+        if (last_update_.box.empty()) {
+            ++rs.skipped;
+            co_return;
+        }
+    } else {
+        last_update_.box = {0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1};
+    }
+
+    co_await set_refresh_mode(mode);
+
+    const auto elapsed = mode == Refresh::PARTIAL ? co_await refresh_partial(frame, last_update_.box)
+                                                  : co_await refresh_full(frame);
+
+    ++rs.count;
+    rs.last = elapsed;
+    rs.total += elapsed;
+    last_frame_ = frame;
+    gray_on_glass_ = false;
+    last_update_.spi_bytes = stats_.bytes - bytes_before;
+}
+
+inline Task<> Epd29::display_gray_async(const GrayFrame& frame) {
+    const size_t bytes_before = stats_.bytes;
+    Frame hi;
+    Frame lo;
+    split_gray4(frame.data(), hi.data(), lo.data(), size_t(PANEL_WIDTH) * PANEL_HEIGHT);
+
+    co_await set_refresh_mode(Refresh::GRAY4);
+    const auto elapsed = co_await refresh_gray(hi, lo);
+    last_frame_ = hi;
+
+    auto& rs = refresh_stats_[static_cast<size_t>(Refresh::GRAY4)];
+    ++rs.count;
+    rs.last = elapsed;
+    rs.total += elapsed;
+
+    // The high plane is the closest 1-bit picture of what is now shown.
+    gray_on_glass_ = true;
+    last_update_ = {};
+    last_update_.mode = Refresh::GRAY4;
+    last_update_.box = {0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1};
+    last_update_.spi_bytes = stats_.bytes - bytes_before;
+}
+
+inline Task<> Epd29::clear_async() {
+    Frame white;
+    white.fill(0xFF);
+    co_await display_async(white, Refresh::FULL);
+}
+
+inline void Epd29::demo_pattern() {
+    Frame new_frame;
+    MonoCanvas canvas(new_frame.data(), PANEL_WIDTH, PANEL_HEIGHT);
+    canvas.fill(true);
+
+    // Horizontal stripes: alternate 16-row black and white bands.
+    for (int row = 0; row < PANEL_HEIGHT; row += 32) {
+        canvas.fill_rect(0, row, PANEL_WIDTH, 16, false);
+    }
+
+    display(new_frame, Refresh::FULL);
+}
+
+inline Task<> Epd29::deep_sleep_async() {
+    co_await power_down();
+}
+
+inline Task<> Epd29::power_down() {
+    send_cmd(0x02);  // power off
+    co_await wait_busy("power off");
+    send_cmd(0x07);  // deep sleep
+    send_data(0xA5);
+}
+
+// The same panel on an SSD1680 controller (Waveshare 2.9" V2). Full
+// refreshes write the frame to both RAM banks and run the OTP waveform.
+// Partial refreshes load the fast LUT once, keep the analog supplies up
+// between updates (0x22 0xC0), and rewrite only the damaged window of each
+// bank before a 0x22 0x0F update.
+class Epd29V2 final : public Epd29 {
+public:
+    using Epd29::Epd29;
+
+protected:
+    Task<> init_controller() override {
+        co_await wait_busy("reset");
+        init_report_ = co_await run_init(
+            SSD1680_INIT, txn_, stats_, [this] { submit(); },
+            [this](const char* stage) { return wait_busy(stage); });
+    }
+
+    Task<> set_refresh_mode(Refresh mode) override {
+        if (mode == refresh_mode_) {
+            co_return;
+        }
+        if (mode == Refresh::GRAY4) {
+            throw std::runtime_error("4-gray waveform not available on the SSD1680 backend");
+        }
+
+        if (mode == Refresh::PARTIAL) {
+            const auto& lut = SSD1680_PARTIAL_LUT;
+            txn_.command(0x32, lut.data(), 153)
+                .command(0x3F, {lut[153]})
+                .command(0x03, {lut[154]})
+                .command(0x04, {lut[155], lut[156], lut[157]})
+                .command(0x2C, {lut[158]})
+                .command(0x37, {0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00})
+                .command(0x3C, {0x80})   // border follows the partial LUT
+                .command(0x22, {0xC0})   // clock + analog on, and leave them on
+                .command(0x20);
+            submit();
+            co_await wait_busy("partial power on");
+        } else {
+            txn_.command(0x3C, {0x05});
+            submit();
+        }
+        refresh_mode_ = mode;
+    }
+
+    Task<std::chrono::milliseconds> refresh_full(const Frame& frame) override {
+        set_window({0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1});
+        upload(0x24, frame.data(), frame.size());
+        set_cursor(0, 0);
+        upload(0x26, frame.data(), frame.size());
+        txn_.command(0x22, {0xF7}).command(0x20);  // load OTP LUT, display mode 1, power off
+        submit();
+        co_return co_await wait_busy("full refresh");
+    }
+
+    Task<std::chrono::milliseconds> refresh_partial(const Frame& frame, const DirtyBox& box) override {
+        gather_window(frame, box);
+        set_window(box);
+        upload(0x24, new_window_.data(), new_window_.size());
+        set_cursor(box.x0, box.y0);
+        upload(0x26, old_window_.data(), old_window_.size());
+        txn_.command(0x22, {0x0F}).command(0x20);  // display mode 2, supplies stay up
+        submit();
+        co_return co_await wait_busy("partial refresh");
+    }
+
+    Task<std::chrono::milliseconds> refresh_gray(const Frame&, const Frame&) override {
+        throw std::runtime_error("4-gray waveform not available on the SSD1680 backend");
+    }
+
+    Task<> power_down() override {
+        send_cmd(0x10);  // deep sleep mode 1
+        send_data(0x01);
+        co_return;
+    }
+
+private:
+    // Queues the RAM window for `box` and parks the address counter at its
+    // top-left corner.
+    void set_window(const DirtyBox& box) {
+        const uint8_t y0 = box.y0 & 0xFF;
+        const uint8_t y1 = box.y1 & 0xFF;
+        txn_.command(0x44, {uint8_t(box.x0 / 8), uint8_t(box.x1 / 8)})
+            .command(0x45, {y0, uint8_t(box.y0 >> 8), y1, uint8_t(box.y1 >> 8)});
+        set_cursor(box.x0, box.y0);
+    }
+
+    void set_cursor(int x, int y) {
+        txn_.command(0x4E, {uint8_t(x / 8)}).command(0x4F, {uint8_t(y & 0xFF), uint8_t(y >> 8)});
+    }
+};
+
+}  // namespace pidisp::epd
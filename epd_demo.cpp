@@ -1,261 +1,25 @@
+#include <algorithm>
 #include <array>
 #include <chrono>
-#include <cerrno>
 #include <cstdint>
-#include <cstring>
-#include <fcntl.h>
+#include <future>
 #include <iostream>
-#include <linux/spi/spidev.h>
-#include <optional>
-#include <stdexcept>
+#include <memory>
 #include <string>
-#include <sys/ioctl.h>
 #include <thread>
-#include <unistd.h>
+#include <utility>
 #include <vector>
 
-#include <gpiod.hpp>
+#include "async_epd.hpp"
+#include "epd29.hpp"
+#include "mono_canvas.hpp"
+#include "mono_convert.hpp"
+#include "mono_rotate.hpp"
+#include "spi_bus.hpp"
 
-namespace {
+using namespace pidisp::epd;
 
-constexpr char SPI_PATH[] = "/dev/spidev0.0";  // CE0 -> panel CS
-constexpr uint32_t SPI_SPEED_HZ = 4'000'000;
-constexpr uint8_t SPI_BITS = 8;
-constexpr uint8_t SPI_MODE = SPI_MODE_0;
-
-constexpr int PANEL_WIDTH = 128;
-constexpr int PANEL_HEIGHT = 296;
-constexpr size_t BUFFER_SIZE = (PANEL_WIDTH * PANEL_HEIGHT) / 8;
-constexpr bool BUSY_ACTIVE_HIGH = true;  // module keeps BUSY high while processing
-
-struct Pins {
-    unsigned int dc;
-    unsigned int rst;
-    unsigned int busy;
-};
-
-class Epd29 {
-public:
-    explicit Epd29(Pins pins, const std::string& chip = "/dev/gpiochip0")
-        : pins_(pins), chip_(chip), spi_fd_(-1) {}
-
-    ~Epd29() {
-        if (spi_fd_ >= 0) {
-            close(spi_fd_);
-        }
-    }
-
-    void init();
-    void clear();
-    void demo_pattern();
-    void deep_sleep();
-
-private:
-    void request_lines();
-    void open_spi();
-    void reset();
-
-    bool busy_asserted();
-    void wait_busy(const std::string& stage, std::chrono::milliseconds poll = std::chrono::milliseconds(20));
-
-    void send_cmd(uint8_t cmd);
-    void send_data(uint8_t byte);
-    void send_data(const uint8_t* data, size_t len);
-
-    Pins pins_;
-    std::string chip_;
-    std::optional<gpiod::line_request> request_;
-    int spi_fd_;
-};
-
-void Epd29::request_lines() {
-    gpiod::chip chip(chip_);
-
-    gpiod::line_settings dc_settings;
-    dc_settings.set_direction(gpiod::line::direction::OUTPUT);
-    dc_settings.set_output_value(gpiod::line::value::INACTIVE);
-
-    gpiod::line_settings rst_settings = dc_settings;
-    rst_settings.set_output_value(gpiod::line::value::ACTIVE);
-
-    gpiod::line_settings busy_settings;
-    busy_settings.set_direction(gpiod::line::direction::INPUT);
-    busy_settings.set_bias(gpiod::line::bias::PULL_UP);
-
-    gpiod::line_config lcfg;
-    lcfg.add_line_settings(pins_.dc, dc_settings);
-    lcfg.add_line_settings(pins_.rst, rst_settings);
-    lcfg.add_line_settings(pins_.busy, busy_settings);
-
-    auto builder = chip.prepare_request();
-    builder.set_consumer("epd-demo");
-    builder.set_line_config(lcfg);
-    request_ = builder.do_request();
-}
-
-void Epd29::open_spi() {
-    spi_fd_ = ::open(SPI_PATH, O_RDWR);
-    if (spi_fd_ < 0) {
-        throw std::runtime_error("failed to open SPI: " + std::string(std::strerror(errno)));
-    }
-
-    if (ioctl(spi_fd_, SPI_IOC_WR_MODE, &SPI_MODE) < 0 ||
-        ioctl(spi_fd_, SPI_IOC_WR_MAX_SPEED_HZ, &SPI_SPEED_HZ) < 0 ||
-        ioctl(spi_fd_, SPI_IOC_WR_BITS_PER_WORD, &SPI_BITS) < 0) {
-        throw std::runtime_error("failed to configure SPI");
-    }
-}
-
-void Epd29::reset() {
-    if (!request_) {
-        throw std::runtime_error("lines not requested");
-    }
-
-    request_->set_value(pins_.rst, gpiod::line::value::ACTIVE);
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    request_->set_value(pins_.rst, gpiod::line::value::INACTIVE);
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    request_->set_value(pins_.rst, gpiod::line::value::ACTIVE);
-    std::this_thread::sleep_for(std::chrono::milliseconds(120));
-}
-
-bool Epd29::busy_asserted() {
-    if (!request_) {
-        throw std::runtime_error("lines not requested");
-    }
-
-    auto value = request_->get_value(pins_.busy);
-    return BUSY_ACTIVE_HIGH ? value == gpiod::line::value::ACTIVE
-                            : value == gpiod::line::value::INACTIVE;
-}
-
-void Epd29::wait_busy(const std::string& stage, std::chrono::milliseconds poll) {
-    auto start = std::chrono::steady_clock::now();
-    auto timeout = start + std::chrono::seconds(20);
-
-    while (busy_asserted()) {
-        if (std::chrono::steady_clock::now() > timeout) {
-            throw std::runtime_error(stage + " timeout waiting for BUSY release");
-        }
-        std::this_thread::sleep_for(poll);
-    }
-
-    if (!stage.empty()) {
-        std::cout << stage << " complete\n";
-    }
-}
-
-void Epd29::send_cmd(uint8_t cmd) {
-    request_->set_value(pins_.dc, gpiod::line::value::INACTIVE);
-    ::write(spi_fd_, &cmd, 1);
-}
-
-void Epd29::send_data(uint8_t byte) {
-    request_->set_value(pins_.dc, gpiod::line::value::ACTIVE);
-    ::write(spi_fd_, &byte, 1);
-}
-
-void Epd29::send_data(const uint8_t* data, size_t len) {
-    request_->set_value(pins_.dc, gpiod::line::value::ACTIVE);
-    ::write(spi_fd_, data, len);
-}
-
-void Epd29::init() {
-    request_lines();
-    open_spi();
-
-    reset();
-
-    // Booster soft start
-    send_cmd(0x06);
-    send_data(0x17);
-    send_data(0x17);
-    send_data(0x17);
-
-    // Power on
-    send_cmd(0x04);
-    wait_busy("power on");
-
-    // Panel settings (KW-BF, BWROTP)
-    send_cmd(0x00);
-    send_data(0x0F);
-
-    // VCOM / data interval
-    send_cmd(0x50);
-    send_data(0xF7);
-
-    // PLL control
-    send_cmd(0x30);
-    send_data(0x3C);
-
-    // Resolution (X, Y)
-    send_cmd(0x61);
-    send_data(PANEL_WIDTH >> 8);
-    send_data(PANEL_WIDTH & 0xFF);
-    send_data(PANEL_HEIGHT >> 8);
-    send_data(PANEL_HEIGHT & 0xFF);
-
-    // VCOM voltage
-    send_cmd(0x82);
-    send_data(0x12);
-}
-
-void Epd29::clear() {
-    std::array<uint8_t, BUFFER_SIZE> white;
-    white.fill(0xFF);
-
-    send_cmd(0x10);  // Old data
-    send_data(white.data(), white.size());
-    send_cmd(0x13);  // New data
-    send_data(white.data(), white.size());
-
-    send_cmd(0x12);  // Refresh
-    wait_busy("clear refresh");
-}
-
-void Epd29::demo_pattern() {
-    std::array<uint8_t, BUFFER_SIZE> old_frame;
-    std::array<uint8_t, BUFFER_SIZE> new_frame;
-
-    old_frame.fill(0xFF);
-    new_frame.fill(0xFF);
-
-    // Horizontal stripes: alternate full-black and full-white rows.
-    for (int row = 0; row < PANEL_HEIGHT; ++row) {
-        bool black_row = (row / 16) % 2 == 0;
-        for (int col = 0; col < PANEL_WIDTH; ++col) {
-            size_t bit_index = row * PANEL_WIDTH + col;
-            size_t byte_index = bit_index / 8;
-            uint8_t bit_mask = 0x80 >> (bit_index % 8);
-
-            if (black_row) {
-                new_frame[byte_index] &= ~bit_mask;  // drive black (0)
-            } else {
-                new_frame[byte_index] |= bit_mask;   // leave white (1)
-            }
-        }
-    }
-
-    send_cmd(0x10);
-    send_data(old_frame.data(), old_frame.size());
-
-    send_cmd(0x13);
-    send_data(new_frame.data(), new_frame.size());
-
-    send_cmd(0x12);
-    wait_busy("refresh");
-}
-
-void Epd29::deep_sleep() {
-    send_cmd(0x02);  // power off
-    wait_busy("power off");
-    send_cmd(0x07);  // deep sleep
-    send_data(0xA5);
-}
-
-}  // namespace
-
-int main() {
+int main(int argc, char** argv) {
     try {
         Pins pins{
             .dc = 25,   // GPIO25 (pin 22)
@@ -263,13 +27,127 @@ int main() {
             .busy = 24  // GPIO24 (pin 18)
         };
 
-        Epd29 epd(pins);
+        // --v2 drives the SSD1680 revision of the panel (Waveshare 2.9" V2).
+        const bool v2 = argc > 1 && std::string(argv[1]) == "--v2";
+        pidisp::SpiBus bus;
+        std::unique_ptr<Epd29> panel =
+            v2 ? std::make_unique<Epd29V2>(bus, pins) : std::make_unique<Epd29>(bus, pins);
+        Epd29& epd = *panel;
+        std::cout << "Controller: " << (v2 ? "SSD1680" : "UC8151") << "\n";
         epd.init();
+        const auto& init = epd.init_report();
+        std::cout << "Init: " << init.elapsed.count() / 1000 << " ms in " << init.batches
+                  << " batches, " << init.spi_syscalls << " SPI syscalls, " << init.gpio_ioctls
+                  << " GPIO ioctls\n";
+        std::cout << "Frame SPI plan: " << epd.planner().describe(BUFFER_SIZE) << "\n";
         epd.clear();
         epd.demo_pattern();
-        epd.deep_sleep();
 
-        std::cout << "EPD demo complete\n";
+        {
+            // Slide a black block down the stripes with fast partial updates,
+            // submitting a frame every 100 ms like duel_test.py does. Frames
+            // that arrive mid-refresh are coalesced into the next one.
+            AsyncEpd async(epd);
+            std::vector<std::future<UpdateReport>> updates;
+            Frame frame;
+            pidisp::MonoCanvas canvas(frame.data(), PANEL_WIDTH, PANEL_HEIGHT);
+            for (int step = 0; step < 20; ++step) {
+                canvas.fill(true);
+                canvas.fill_rect(32, step * 12, 64, 40, false);
+                const auto start = std::chrono::steady_clock::now();
+                updates.push_back(async.display(frame, Refresh::PARTIAL));
+                std::cout << "  queued update " << step << " in "
+                          << std::chrono::duration_cast<std::chrono::microseconds>(
+                                 std::chrono::steady_clock::now() - start)
+                                 .count()
+                          << " us, " << async.pending() << " pending\n";
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+
+            for (auto& pending : updates) {
+                const UpdateReport update = pending.get();
+                std::cout << "  window " << update.box.x0 << "," << update.box.y0 << " - "
+                          << update.box.x1 << "," << update.box.y1 << ": " << update.box.bytes()
+                          << " B/plane, " << update.spi_bytes << " B on the wire (full frame "
+                          << 2 * BUFFER_SIZE << " B), diff " << update.diff_time.count() << " us, "
+                          << update.coalesced << " coalesced\n";
+            }
+            const auto queue = async.stats();
+            std::cout << "Update queue: " << queue.submitted << " submitted, " << queue.coalesced
+                      << " coalesced, " << queue.refreshes << " refreshes\n";
+
+            // Landscape layout drawn at 296x128 and rotated onto the panel.
+            std::array<uint8_t, BUFFER_SIZE> landscape;
+            pidisp::MonoCanvas wide(landscape.data(), PANEL_HEIGHT, PANEL_WIDTH);
+            wide.fill(true);
+            wide.fill_rect(0, 0, PANEL_HEIGHT, 24, false);  // title bar
+            for (int i = 0; i < 4; ++i) {
+                wide.draw_rect(8 + i * 72, 36, 64, 84, false);
+            }
+            const auto rotate_start = std::chrono::steady_clock::now();
+            pidisp::rotate_mono(landscape.data(), PANEL_HEIGHT, PANEL_WIDTH, PANEL_HEIGHT / 8, frame.data(),
+                                ROW_BYTES, pidisp::Rotation::R90);
+            std::cout << "Landscape rotate: "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - rotate_start)
+                             .count()
+                      << " us\n";
+            async.display(frame, Refresh::PARTIAL).get();
+
+            // A radial gray ramp, Atkinson-dithered straight into the frame.
+            std::vector<uint8_t> gray(size_t(PANEL_WIDTH) * PANEL_HEIGHT);
+            for (int y = 0; y < PANEL_HEIGHT; ++y) {
+                for (int x = 0; x < PANEL_WIDTH; ++x) {
+                    const int dx = x - PANEL_WIDTH / 2;
+                    const int dy = y - PANEL_HEIGHT / 2;
+                    gray[size_t(y) * PANEL_WIDTH + x] = std::min(255, (dx * dx + dy * dy) / 90);
+                }
+            }
+            pidisp::gray_to_mono(gray.data(), PANEL_WIDTH, frame.data(), ROW_BYTES, PANEL_WIDTH,
+                                 PANEL_HEIGHT, pidisp::MonoDither::ATKINSON);
+            const UpdateReport mono = async.display(frame, Refresh::FULL).get();
+
+            // The same ramp in 4-level gray, for comparison with 1-bit. The
+            // SSD1680 backend has no 4-gray waveform.
+            if (!v2) {
+                GrayFrame gray4;
+                pidisp::gray_to_gray4(gray.data(), PANEL_WIDTH, gray4.data(), PANEL_WIDTH / 4,
+                                      PANEL_WIDTH, PANEL_HEIGHT);
+                const UpdateReport shaded = async.display_gray(gray4).get();
+                std::cout << "1-bit full: " << epd.refresh_stats(Refresh::FULL).last.count() << " ms, "
+                          << mono.spi_bytes << " B; 4-gray: "
+                          << epd.refresh_stats(Refresh::GRAY4).last.count() << " ms, "
+                          << shaded.spi_bytes << " B (incl. LUT load)\n";
+            }
+
+            // Give the scheduler an idle window to clean up the ghosting.
+            std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+            const auto ghosting = async.ghosting();
+            std::cout << "Ghosting: " << ghosting.partial << " partial, " << ghosting.full_requested
+                      << " full requested, " << ghosting.full_forced << " forced full, "
+                      << ghosting.full_idle << " idle full, max wear " << ghosting.max_wear << "\n";
+            // Leave the panel blank for storage.
+            async.clear();
+            async.deep_sleep().get();
+        }
+
+        for (auto [mode, name] : {std::pair{Refresh::FULL, "full"}, std::pair{Refresh::PARTIAL, "partial"},
+                                  std::pair{Refresh::GRAY4, "gray4"}}) {
+            const auto& rs = epd.refresh_stats(mode);
+            if (rs.count) {
+                std::cout << name << " refresh: " << rs.count << " x, last " << rs.last.count()
+                          << " ms, avg " << rs.total.count() / rs.count << " ms, " << rs.skipped
+                          << " skipped\n";
+            }
+        }
+
+        const auto& stats = epd.stats();
+        std::cout << "EPD demo complete\n"
+                  << "SPI syscalls: " << stats.spi_syscalls << ", GPIO ioctls: " << stats.gpio_ioctls
+                  << ", bytes: " << stats.bytes << "\n";
+        const auto bus_stats = epd.bus_client().stats();
+        std::cout << "Bus: " << bus_stats.grants << " grants, " << bus_stats.yields << " yields, wait max "
+                  << bus_stats.wait_max.count() << " us\n";
     } catch (const std::exception& ex) {
         std::cerr << "EPD demo failed: " << ex.what() << "\n";
         return 1;
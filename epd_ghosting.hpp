@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include "epd29.hpp"
+#include "task.hpp"
+
+namespace pidisp::epd {
+
+struct GhostingConfig {
+    uint32_t max_partials = 8;   // partials a region takes before a full refresh is forced
+    uint32_t idle_partials = 2;  // wear worth a cleanup refresh once idle
+    std::chrono::milliseconds idle_after{3000};
+};
+
+// Decides between partial and full refreshes. Each partial update adds wear to
+// the regions its window covers, and a full refresh clears all wear. An update
+// that would push any region past `max_partials` is promoted to a full
+// refresh. Once the panel has been idle for `idle_after`, any wear at or above
+// `idle_partials` should be cleaned up with a full refresh of the current
+// frame; the scheduler keeps no clock, so noticing the idle time is up to the
+// caller.
+class GhostingScheduler {
+public:
+    static constexpr int REGION_SIZE = 32;  // pixels, square
+    static constexpr int REGION_COLS = (PANEL_WIDTH + REGION_SIZE - 1) / REGION_SIZE;
+    static constexpr int REGION_ROWS = (PANEL_HEIGHT + REGION_SIZE - 1) / REGION_SIZE;
+
+    struct Counters {
+        uint64_t partial;         // partial refreshes performed
+        uint64_t full_requested;  // full refreshes the caller asked for
+        uint64_t full_forced;     // partials promoted because a region was worn out
+        uint64_t full_idle;       // cleanup refreshes while idle
+        uint32_t max_wear;        // highest partial count of any region right now
+    };
+
+    explicit GhostingScheduler(GhostingConfig config = {}) : config_(config) {}
+
+    const GhostingConfig& config() const { return config_; }
+
+    Refresh choose(const DirtyBox& box, Refresh requested) {
+        if (requested == Refresh::FULL) {
+            ++counters_.full_requested;
+            return Refresh::FULL;
+        }
+        if (!box.empty() && max_wear(box) + 1 > config_.max_partials) {
+            ++counters_.full_forced;
+            return Refresh::FULL;
+        }
+        return Refresh::PARTIAL;
+    }
+
+    // Records what was actually sent; `box` is the refreshed window.
+    void record(Refresh mode, const DirtyBox& box) {
+        if (box.empty()) {
+            return;
+        }
+        if (mode == Refresh::FULL) {
+            reset();
+            return;
+        }
+        ++counters_.partial;
+        for_each_region(box, [](uint32_t& wear) { ++wear; });
+    }
+
+    bool wants_idle_refresh() const { return counters().max_wear >= config_.idle_partials; }
+    void record_idle_refresh() {
+        ++counters_.full_idle;
+        reset();
+    }
+
+    void reset() { wear_.fill(0); }
+
+    Counters counters() const {
+        Counters c = counters_;
+        c.max_wear = *std::max_element(wear_.begin(), wear_.end());
+        return c;
+    }
+
+private:
+    template <typename Fn>
+    void for_each_region(const DirtyBox& box, Fn&& fn) {
+        for (int ry = box.y0 / REGION_SIZE; ry <= box.y1 / REGION_SIZE; ++ry) {
+            for (int rx = box.x0 / REGION_SIZE; rx <= box.x1 / REGION_SIZE; ++rx) {
+                fn(wear_[ry * REGION_COLS + rx]);
+            }
+        }
+    }
+
+    uint32_t max_wear(const DirtyBox& box) {
+        uint32_t worst = 0;
+        for_each_region(box, [&](uint32_t& wear) { worst = std::max(worst, wear); });
+        return worst;
+    }
+
+    GhostingConfig config_;
+    Counters counters_{};
+    std::array<uint32_t, REGION_COLS * REGION_ROWS> wear_{};
+};
+
+// One update with the waveform `ghosting` picks for `requested`: the frame is
+// diffed once, for both the choice and the partial window, and what was sent
+// is recorded. `frame` must outlive the task.
+inline Task<UpdateReport> display_scheduled(Epd29& epd, GhostingScheduler& ghosting, const Frame& frame,
+                                            Refresh requested) {
+    const auto start = std::chrono::steady_clock::now();
+    const DirtyBox box = diff_box(epd.last_frame(), frame);
+    const auto diff_time =
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+    co_await epd.display_async(frame, ghosting.choose(box, requested), box);
+    UpdateReport report = epd.last_update();
+    report.diff_time = diff_time;
+    ghosting.record(report.mode, report.box);
+    co_return report;
+}
+
+}  // namespace pidisp::epd
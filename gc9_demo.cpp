@@ -1,207 +1,16 @@
 #include <algorithm>
-#include <array>
 #include <chrono>
-#include <cerrno>
-#include <cstring>
-#include <fcntl.h>
-#include <initializer_list>
 #include <iostream>
-#include <linux/spi/spidev.h>
-#include <optional>
 #include <stdexcept>
-#include <string>
-#include <sys/ioctl.h>
 #include <thread>
-#include <unistd.h>
 #include <vector>
 
-#include <gpiod.hpp>
+#include "gc9_panel.hpp"
+#include "gc9_presenter.hpp"
+#include "rgb565_convert.hpp"
+#include "spi_bus.hpp"
 
-namespace {
-
-constexpr char SPI_PATH[] = "/dev/spidev0.0";
-constexpr uint32_t SPI_SPEED_HZ = 2'000'000;   // GC9A01A is fine up to 50 MHz
-constexpr uint8_t SPI_BITS = 8;
-constexpr uint8_t SPI_MODE = SPI_MODE_3;
-
-constexpr uint16_t PANEL_WIDTH = 240;
-constexpr uint16_t PANEL_HEIGHT = 240;
-
-struct ControlPins {
-    unsigned int cs;
-    unsigned int dc;
-    unsigned int rst;
-};
-
-class Gc9Panel {
-public:
-    Gc9Panel(ControlPins pins, const std::string& chip = "/dev/gpiochip0")
-        : pins_(pins), chip_(chip), spi_fd_(-1) {}
-
-    ~Gc9Panel() {
-        if (spi_fd_ >= 0) {
-            close(spi_fd_);
-        }
-    }
-
-    void init();
-    void fill_color(uint16_t rgb565);
-
-private:
-    void open_spi();
-    void request_lines();
-
-    void set_pin(unsigned int offset, bool value);
-
-    void send(uint8_t cmd, std::initializer_list<uint8_t> data = {}, uint16_t delay_ms = 0);
-    void ram_write_begin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
-    void write_pixels(const uint8_t* data, size_t bytes);
-
-    ControlPins pins_;
-    std::string chip_;
-    std::optional<gpiod::line_request> request_;
-    int spi_fd_;
-};
-
-void Gc9Panel::open_spi() {
-    spi_fd_ = ::open(SPI_PATH, O_RDWR);
-    if (spi_fd_ < 0) {
-        throw std::runtime_error("failed to open " + std::string(SPI_PATH) + ": " + std::strerror(errno));
-    }
-
-    if (ioctl(spi_fd_, SPI_IOC_WR_MODE, &SPI_MODE) < 0 ||
-        ioctl(spi_fd_, SPI_IOC_WR_MAX_SPEED_HZ, &SPI_SPEED_HZ) < 0 ||
-        ioctl(spi_fd_, SPI_IOC_WR_BITS_PER_WORD, &SPI_BITS) < 0) {
-        throw std::runtime_error("failed to configure SPI");
-    }
-}
-
-void Gc9Panel::request_lines() {
-    gpiod::chip chip(chip_);
-    gpiod::line_settings settings;
-    settings.set_direction(gpiod::line::direction::OUTPUT);
-    settings.set_output_value(gpiod::line::value::INACTIVE);
-
-    gpiod::line_config lcfg;
-    lcfg.add_line_settings(pins_.cs, settings);
-    lcfg.add_line_settings(pins_.dc, settings);
-    lcfg.add_line_settings(pins_.rst, settings);
-
-    gpiod::request_config rcfg;
-    rcfg.set_consumer("gc9-demo");
-
-    auto builder = chip.prepare_request();
-    builder.set_consumer("gc9-demo");
-    builder.set_line_config(lcfg);
-    request_ = builder.do_request();
-}
-
-void Gc9Panel::set_pin(unsigned int offset, bool value) {
-    if (!request_) {
-        throw std::runtime_error("GPIO lines not requested");
-    }
-
-    request_->set_value(offset, value ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
-}
-
-void Gc9Panel::send(uint8_t cmd, std::initializer_list<uint8_t> data, uint16_t delay_ms) {
-    set_pin(pins_.cs, false);
-    set_pin(pins_.dc, false);
-    ::write(spi_fd_, &cmd, 1);
-
-    if (!data.size()) {
-        set_pin(pins_.cs, true);
-    } else {
-        std::vector<uint8_t> payload(data);
-        set_pin(pins_.dc, true);
-        ::write(spi_fd_, payload.data(), payload.size());
-        set_pin(pins_.cs, true);
-    }
-
-    if (delay_ms) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
-    }
-}
-
-void Gc9Panel::ram_write_begin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
-    send(0x2A, {static_cast<uint8_t>(x0 >> 8), static_cast<uint8_t>(x0 & 0xFF),
-                static_cast<uint8_t>(x1 >> 8), static_cast<uint8_t>(x1 & 0xFF)});
-    send(0x2B, {static_cast<uint8_t>(y0 >> 8), static_cast<uint8_t>(y0 & 0xFF),
-                static_cast<uint8_t>(y1 >> 8), static_cast<uint8_t>(y1 & 0xFF)});
-    send(0x2C);
-    set_pin(pins_.cs, false);
-    set_pin(pins_.dc, true);
-}
-
-void Gc9Panel::write_pixels(const uint8_t* data, size_t bytes) {
-    ::write(spi_fd_, data, bytes);
-}
-
-void Gc9Panel::init() {
-    request_lines();
-    open_spi();
-
-    // hardware reset
-    set_pin(pins_.rst, false);
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-    set_pin(pins_.rst, true);
-    std::this_thread::sleep_for(std::chrono::milliseconds(50));
-
-    // GC9A01A initialisation sequence (borrowed from Adafruit GC9A01A)
-    send(0xEF, {0x03, 0x80, 0x02});
-    send(0xCF, {0x00, 0xC1, 0x30});
-    send(0xED, {0x64, 0x03, 0x12, 0x81});
-    send(0xE8, {0x85, 0x00, 0x78});
-    send(0xCB, {0x39, 0x2C, 0x00, 0x34, 0x02});
-    send(0xF7, {0x20});
-    send(0xEA, {0x00, 0x00});
-
-    send(0xC0, {0x23});  // power control
-    send(0xC1, {0x10});
-    send(0xC5, {0x3e, 0x28});
-    send(0xC7, {0x86});
-
-    send(0x36, {0x28});  // memory access
-    send(0x3A, {0x55});  // 16-bit color
-
-    send(0xB1, {0x00, 0x18});
-    send(0xB6, {0x08, 0x82, 0x27});
-
-    send(0xF2, {0x00});
-    send(0x26, {0x01});
-
-    send(0xE0, {0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1, 0x37, 0x07,
-                0x10, 0x03, 0x0E, 0x09, 0x00});  // positive gamma
-    send(0xE1, {0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1, 0x48, 0x08,
-                0x0F, 0x0C, 0x31, 0x36, 0x0F});  // negative gamma
-
-    send(0x21);        // inversion on
-    send(0x11, {}, 120);
-    send(0x29, {}, 20);  // display on
-}
-
-void Gc9Panel::fill_color(uint16_t rgb565) {
-    ram_write_begin(0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1);
-
-    std::array<uint8_t, 512> chunk{};
-    for (size_t i = 0; i < chunk.size(); i += 2) {
-        chunk[i] = rgb565 >> 8;
-        chunk[i + 1] = rgb565 & 0xFF;
-    }
-
-    constexpr size_t total_pixels = PANEL_WIDTH * PANEL_HEIGHT;
-    size_t pixels_remaining = total_pixels;
-
-    while (pixels_remaining) {
-        const size_t pixels_this_round = std::min(pixels_remaining, chunk.size() / 2);
-        write_pixels(chunk.data(), pixels_this_round * 2);
-        pixels_remaining -= pixels_this_round;
-    }
-
-    set_pin(pins_.cs, true);  // finish RAM write
-}
-
-}  // namespace
+using namespace pidisp::gc9;
 
 int main() {
     try {
@@ -211,12 +20,25 @@ int main() {
             .rst = 6,  // GPIO6  (pin 31)
         };
 
-        Gc9Panel panel(pins);
+        const auto boot = std::chrono::steady_clock::now();
+        pidisp::SpiBus bus;
+        Gc9Panel panel(bus, pins);
         panel.init();
+        const auto& init = panel.init_report();
+        std::cout << "Init: " << init.elapsed.count() / 1000 << " ms in " << init.batches
+                  << " batches, " << init.spi_syscalls << " SPI syscalls, " << init.gpio_ioctls
+                  << " GPIO ioctls\n";
+        std::cout << "Full frame SPI plan: "
+                  << panel.planner().describe(size_t(PANEL_WIDTH) * PANEL_HEIGHT * 2) << "\n";
 
         std::cout << "Filling screen RED, GREEN, BLUE...\n";
 
         panel.fill_color(0xF800);
+        std::cout << "Time to first pixel: "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - boot)
+                         .count()
+                  << " ms\n";
         std::this_thread::sleep_for(std::chrono::seconds(2));
         panel.fill_color(0x07E0);
         std::this_thread::sleep_for(std::chrono::seconds(2));
@@ -224,7 +46,97 @@ int main() {
         std::this_thread::sleep_for(std::chrono::seconds(2));
         panel.fill_color(0xFFFF);
 
-        std::cout << "Done. Display should be white.\n";
+        std::cout << "Counting on a white background via dirty rectangles...\n";
+        size_t partial_bytes = 0;
+        for (int i = 0; i < 10; ++i) {
+            // A "digit" cell: clear it, then draw a bar whose height tracks the count.
+            panel.fill_rect(100, 100, 40, 40, 0xFFFF);
+            panel.fill_rect(110, 135 - i * 3, 20, 5 + i * 3, 0x001F);
+            partial_bytes += panel.flush();
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+        std::cout << "10 partial updates sent " << partial_bytes << " bytes (one full frame is "
+                  << PANEL_WIDTH * PANEL_HEIGHT * 2 << ")\n";
+
+        std::cout << "Presenting whole frames through the tile diff...\n";
+        std::vector<uint16_t> frame(size_t(PANEL_WIDTH) * PANEL_HEIGHT, 0x0000);
+        for (int i = 0; i < 20; ++i) {
+            // A 32x32 square sliding right across a black frame.
+            std::fill(frame.begin(), frame.end(), 0x0000);
+            for (int y = 104; y < 136; ++y) {
+                std::fill_n(frame.begin() + y * PANEL_WIDTH + 20 + i * 8, 32, 0xFFE0);
+            }
+            panel.present(frame.data());
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        const auto& diff = panel.diff_stats();
+        std::cout << diff.frames << " frames: " << diff.total_bytes_sent << " bytes sent, "
+                  << diff.total_bytes_saved << " bytes saved (last frame: " << diff.tiles_changed
+                  << " tiles in " << diff.windows << " windows)\n";
+
+        std::cout << "Full-frame fill timing, rectangular vs round mode...\n";
+        for (bool round : {false, true}) {
+            panel.set_round_mode(round);
+            const size_t bytes_before = panel.stats().bytes;
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < 10; ++i) {
+                panel.fill_color(i % 2 ? 0xF81F : 0x07FF);
+            }
+            const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+            std::cout << (round ? "  round: " : "  rect:  ") << elapsed.count() / 10 << " ms/frame, "
+                      << (panel.stats().bytes - bytes_before) / 10 << " bytes/frame\n";
+        }
+        std::cout << "  round mode skipped " << panel.round_bytes_skipped() / 10
+                  << " bytes/frame outside the circle\n";
+
+        std::cout << "Rendering on the main thread while a flush thread streams...\n";
+        for (auto mode : {AsyncPresenter::Mode::MAILBOX, AsyncPresenter::Mode::FIFO}) {
+            AsyncPresenter::Stats result{};
+            {
+                AsyncPresenter presenter(panel, mode);
+                for (int i = 0; i < 60; ++i) {
+                    uint16_t* frame = presenter.begin_frame();
+                    std::fill_n(frame, size_t(PANEL_WIDTH) * PANEL_HEIGHT, 0x0000);
+                    for (int y = 104; y < 136; ++y) {
+                        std::fill_n(frame + y * PANEL_WIDTH + (i * 4) % (PANEL_WIDTH - 32), 32, 0x07E0);
+                    }
+                    presenter.submit();
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                }
+                result = presenter.stats();
+            }
+            std::cout << (mode == AsyncPresenter::Mode::MAILBOX ? "  mailbox: " : "  fifo:    ")
+                      << result.presented << " presented, " << result.dropped << " dropped, latency avg "
+                      << result.latency_avg_us << " us, max " << result.latency_max_us << " us\n";
+        }
+
+        std::cout << "Blitting an RGB888 gradient (" << pidisp::best_rgb565_kernel().name
+                  << " kernel)...\n";
+        std::vector<uint8_t> gradient(size_t(PANEL_WIDTH) * PANEL_HEIGHT * 3);
+        for (size_t y = 0; y < PANEL_HEIGHT; ++y) {
+            for (size_t x = 0; x < PANEL_WIDTH; ++x) {
+                uint8_t* px = &gradient[(y * PANEL_WIDTH + x) * 3];
+                px[0] = x * 255 / (PANEL_WIDTH - 1);
+                px[1] = y * 255 / (PANEL_HEIGHT - 1);
+                px[2] = 128;
+            }
+        }
+        for (auto dither : {pidisp::Dither::NONE, pidisp::Dither::ORDERED,
+                            pidisp::Dither::FLOYD_STEINBERG}) {
+            panel.blit(0, 0, PANEL_WIDTH, PANEL_HEIGHT, gradient.data(), PANEL_WIDTH * 3,
+                       pidisp::PixelFormat::RGB888, dither);
+            panel.flush();
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+
+        const auto& stats = panel.stats();
+        std::cout << "Done. Display should show the Floyd-Steinberg dithered gradient.\n"
+                  << "SPI syscalls: " << stats.spi_syscalls << ", GPIO ioctls: " << stats.gpio_ioctls
+                  << ", bytes: " << stats.bytes << "\n";
+        const auto bus_stats = panel.bus_client().stats();
+        std::cout << "Bus: " << bus_stats.grants << " grants, " << bus_stats.contended
+                  << " contended, wait max " << bus_stats.wait_max.count() << " us\n";
     } catch (const std::exception& ex) {
         std::cerr << "GC9 demo failed: " << ex.what() << "\n";
         return 1;
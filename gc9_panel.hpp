@@ -0,0 +1,699 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <linux/spi/spidev.h>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gpiod.hpp>
+
+#include "panel_init.hpp"
+#include "rgb565_convert.hpp"
+#include "spi_bus.hpp"
+#include "spi_transfer.hpp"
+
+// 240x240 round GC9A01 LCD: framebuffer with damage tracking, tile-diffed
+// full-frame presents and circle-clipped RAM windows.
+namespace pidisp::gc9 {
+
+constexpr char SPI_PATH[] = "/dev/spidev0.0";
+constexpr uint32_t SPI_SPEED_HZ = 2'000'000;   // GC9A01A is fine up to 50 MHz
+constexpr uint8_t SPI_BITS = 8;
+constexpr uint8_t SPI_MODE = SPI_MODE_3;
+// Animated content: a bus request is due within about one 100 Hz frame.
+constexpr std::chrono::milliseconds BUS_DEADLINE{10};
+
+constexpr uint16_t PANEL_WIDTH = 240;
+constexpr uint16_t PANEL_HEIGHT = 240;
+
+constexpr size_t MAX_DAMAGE_RECTS = 8;
+
+constexpr uint16_t TILE_SIZE = 16;
+constexpr uint16_t TILE_COLS = PANEL_WIDTH / TILE_SIZE;
+constexpr uint16_t TILE_ROWS = PANEL_HEIGHT / TILE_SIZE;
+static_assert(PANEL_WIDTH % TILE_SIZE == 0 && PANEL_HEIGHT % TILE_SIZE == 0);
+
+// What opening one more RAM window costs, expressed in pixel bytes so it can
+// be weighed against bytes wasted by merging: the 11-byte CASET/RASET/RAMWR
+// preamble plus ~11 syscalls at roughly 8 us each on a Pi 4. The syscall
+// time is converted at the clock the bus actually runs the panel at.
+constexpr size_t window_overhead_bytes(uint32_t speed_hz) {
+    return 11 + size_t(uint64_t(11 * 8) * (speed_hz / 8) / 1'000'000);
+}
+
+// Visible columns of one panel row; the GC9A01 glass is a 240 px circle.
+struct RowSpan {
+    uint16_t x0, x1;
+};
+
+// Pixels whose centre lies inside the circle inscribed in the panel.
+inline const std::array<RowSpan, PANEL_HEIGHT>& visible_spans() {
+    static const auto spans = [] {
+        std::array<RowSpan, PANEL_HEIGHT> table{};
+        const double radius = PANEL_WIDTH / 2.0;
+        const double cx = (PANEL_WIDTH - 1) / 2.0;
+        const double cy = (PANEL_HEIGHT - 1) / 2.0;
+        for (uint16_t y = 0; y < PANEL_HEIGHT; ++y) {
+            const double dy = y - cy;
+            const double half = std::sqrt(std::max(0.0, radius * radius - dy * dy));
+            const int x0 = std::max(0, int(std::ceil(cx - half)));
+            const int x1 = std::min(PANEL_WIDTH - 1, int(std::floor(cx + half)));
+            table[y] = {uint16_t(x0), uint16_t(x1)};
+        }
+        return table;
+    }();
+    return spans;
+}
+
+// Inclusive panel coordinates, the same convention as CASET/RASET.
+struct Rect {
+    uint16_t x0, y0, x1, y1;
+
+    uint32_t area() const { return uint32_t(x1 - x0 + 1) * (y1 - y0 + 1); }
+
+    Rect united(const Rect& o) const {
+        return {std::min(x0, o.x0), std::min(y0, o.y0), std::max(x1, o.x1), std::max(y1, o.y1)};
+    }
+
+    // Overlapping or edge-adjacent, i.e. their union wastes no pixels along the seam.
+    bool touches(const Rect& o) const {
+        return x0 <= o.x1 + 1 && o.x0 <= x1 + 1 && y0 <= o.y1 + 1 && o.y0 <= y1 + 1;
+    }
+};
+
+// GC9A01A initialisation sequence (borrowed from Adafruit GC9A01A). Replayed
+// in two batches: everything up to sleep-out, then display-on.
+constexpr std::array GC9_INIT{
+    init_cmd(0xEF, {0x03, 0x80, 0x02}),
+    init_cmd(0xCF, {0x00, 0xC1, 0x30}),
+    init_cmd(0xED, {0x64, 0x03, 0x12, 0x81}),
+    init_cmd(0xE8, {0x85, 0x00, 0x78}),
+    init_cmd(0xCB, {0x39, 0x2C, 0x00, 0x34, 0x02}),
+    init_cmd(0xF7, {0x20}),
+    init_cmd(0xEA, {0x00, 0x00}),
+
+    init_cmd(0xC0, {0x23}),  // power control
+    init_cmd(0xC1, {0x10}),
+    init_cmd(0xC5, {0x3e, 0x28}),
+    init_cmd(0xC7, {0x86}),
+
+    init_cmd(0x36, {0x28}),  // memory access
+    init_cmd(0x3A, {0x55}),  // 16-bit color
+
+    init_cmd(0xB1, {0x00, 0x18}),
+    init_cmd(0xB6, {0x08, 0x82, 0x27}),
+
+    init_cmd(0xF2, {0x00}),
+    init_cmd(0x26, {0x01}),
+
+    init_cmd(0xE0, {0x0F, 0x31, 0x2B, 0x0C, 0x0E, 0x08, 0x4E, 0xF1, 0x37, 0x07,
+                            0x10, 0x03, 0x0E, 0x09, 0x00}),  // positive gamma
+    init_cmd(0xE1, {0x00, 0x0E, 0x14, 0x03, 0x11, 0x07, 0x31, 0xC1, 0x48, 0x08,
+                            0x0F, 0x0C, 0x31, 0x36, 0x0F}),  // negative gamma
+
+    init_cmd(0x21),       // inversion on
+    init_cmd(0x11, {}, 120),
+    init_cmd(0x29, {}, 20),  // display on
+};
+static_assert(valid_init(GC9_INIT, {{0x36, 1}, {0x3A, 1}, {0x21, 0}, {0x11, 0}, {0x29, 0},
+                                    {0xE0, 15}, {0xE1, 15}}));
+
+struct ControlPins {
+    unsigned int cs;
+    unsigned int dc;
+    unsigned int rst;
+};
+
+// Per-frame and cumulative counters for Gc9Panel::present().
+struct DiffStats {
+    size_t tiles_changed = 0;
+    size_t windows = 0;
+    size_t bytes_sent = 0;
+    size_t bytes_saved = 0;
+
+    size_t frames = 0;
+    size_t total_bytes_sent = 0;
+    size_t total_bytes_saved = 0;
+};
+
+// Hashes whole frames in TILE_SIZE tiles and turns the tiles that changed
+// since the previous frame into a short list of RAM windows. Only hashes are
+// kept between frames, so a collision would hide a change; with 64-bit hashes
+// over 512-byte tiles that is not a practical concern for UI content.
+class TileDiff {
+public:
+    // `frame` is host-order RGB565, row-major, PANEL_WIDTH pixels per row.
+    // Tiles overlapping `forced` are reported as changed regardless of hash.
+    const std::vector<Rect>& diff(const uint16_t* frame, const std::vector<Rect>& forced);
+
+    void invalidate() { valid_ = false; }
+    size_t changed_tiles() const { return changed_; }
+
+    // Bytes a merge may waste before a separate window is cheaper.
+    void set_window_overhead(size_t bytes) { overhead_ = bytes; }
+
+private:
+    static uint64_t hash_tile(const uint16_t* frame, uint16_t tx, uint16_t ty);
+    void merge_windows();
+
+    std::array<uint64_t, TILE_COLS * TILE_ROWS> hashes_{};
+    std::array<bool, TILE_COLS * TILE_ROWS> dirty_{};
+    bool valid_ = false;
+    size_t changed_ = 0;
+    size_t overhead_ = window_overhead_bytes(SPI_SPEED_HZ);
+    std::vector<Rect> windows_;
+};
+
+inline uint64_t TileDiff::hash_tile(const uint16_t* frame, uint16_t tx, uint16_t ty) {
+    // FNV-style multiply/xor over 64-bit words; a tile row is 32 bytes.
+    uint64_t h = 0xcbf29ce484222325ull;
+    const uint16_t* row = frame + size_t(ty) * TILE_SIZE * PANEL_WIDTH + tx * TILE_SIZE;
+    for (uint16_t y = 0; y < TILE_SIZE; ++y, row += PANEL_WIDTH) {
+        for (size_t i = 0; i < TILE_SIZE * sizeof(uint16_t); i += sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, reinterpret_cast<const uint8_t*>(row) + i, sizeof(word));
+            h = (h ^ word) * 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+    }
+    return h;
+}
+
+inline const std::vector<Rect>& TileDiff::diff(const uint16_t* frame,
+                                               const std::vector<Rect>& forced) {
+    for (uint16_t ty = 0; ty < TILE_ROWS; ++ty) {
+        for (uint16_t tx = 0; tx < TILE_COLS; ++tx) {
+            const size_t i = ty * TILE_COLS + tx;
+            const uint64_t h = hash_tile(frame, tx, ty);
+            dirty_[i] = !valid_ || h != hashes_[i];
+            hashes_[i] = h;
+        }
+    }
+    valid_ = true;
+
+    for (const Rect& r : forced) {
+        for (uint16_t ty = r.y0 / TILE_SIZE; ty <= r.y1 / TILE_SIZE; ++ty) {
+            for (uint16_t tx = r.x0 / TILE_SIZE; tx <= r.x1 / TILE_SIZE; ++tx) {
+                dirty_[ty * TILE_COLS + tx] = true;
+            }
+        }
+    }
+    changed_ = std::count(dirty_.begin(), dirty_.end(), true);
+
+    merge_windows();
+    return windows_;
+}
+
+inline void TileDiff::merge_windows() {
+    // Work in tile units, then scale to pixels at the end.
+    constexpr size_t TILE_BYTES = size_t(TILE_SIZE) * TILE_SIZE * 2;
+    const auto waste_bytes = [](const Rect& a, const Rect& b) {
+        return size_t(a.united(b).area() - a.area() - b.area()) * TILE_BYTES;
+    };
+
+    windows_.clear();
+    std::vector<Rect> open;  // windows that end on the previous tile row
+    std::vector<Rect> spans;
+
+    for (uint16_t ty = 0; ty < TILE_ROWS; ++ty) {
+        // Horizontal pass: runs of dirty tiles, bridging gaps that are cheaper
+        // to send than a second window.
+        spans.clear();
+        for (uint16_t tx = 0; tx < TILE_COLS; ++tx) {
+            if (!dirty_[ty * TILE_COLS + tx]) {
+                continue;
+            }
+            if (!spans.empty()) {
+                Rect& last = spans.back();
+                const size_t gap = size_t(tx - last.x1 - 1) * TILE_BYTES;
+                if (gap <= overhead_) {
+                    last.x1 = tx;
+                    continue;
+                }
+            }
+            spans.push_back({tx, ty, tx, ty});
+        }
+
+        // Vertical pass: extend an open window downward when the extra bytes
+        // cost less than opening a fresh one; otherwise close it.
+        std::vector<Rect> next;
+        for (const Rect& span : spans) {
+            auto best = open.end();
+            size_t best_waste = overhead_ + 1;
+            for (auto it = open.begin(); it != open.end(); ++it) {
+                const size_t waste = waste_bytes(*it, span);
+                if (waste < best_waste) {
+                    best_waste = waste;
+                    best = it;
+                }
+            }
+            if (best != open.end()) {
+                next.push_back(best->united(span));
+                open.erase(best);
+            } else {
+                next.push_back(span);
+            }
+        }
+        windows_.insert(windows_.end(), open.begin(), open.end());
+        open.swap(next);
+    }
+    windows_.insert(windows_.end(), open.begin(), open.end());
+
+    for (Rect& w : windows_) {
+        w = {uint16_t(w.x0 * TILE_SIZE), uint16_t(w.y0 * TILE_SIZE),
+             uint16_t((w.x1 + 1) * TILE_SIZE - 1), uint16_t((w.y1 + 1) * TILE_SIZE - 1)};
+    }
+}
+
+class Gc9Panel {
+public:
+    // `spi` overrides the SPI_* defaults, e.g. to add SPI_NO_CS when the
+    // panel shares a spidev device with one that uses the hardware CS.
+    Gc9Panel(SpiBus& bus, ControlPins pins, const std::string& chip = "/dev/gpiochip0",
+             SpiDeviceConfig spi = {SPI_PATH, SPI_MODE, SPI_SPEED_HZ, SPI_BITS})
+        : pins_(pins), chip_(chip), bus_(bus.attach("gc9", std::move(spi), BUS_DEADLINE)),
+          fb_(size_t(PANEL_WIDTH) * PANEL_HEIGHT * 2),
+          window_overhead_(window_overhead_bytes(bus_.config().speed_hz)) {
+        planner_.set_clock(bus_.config().speed_hz, bus_.config().bits);
+        diff_.set_window_overhead(window_overhead_);
+    }
+
+    void init() { init_async().get(); }
+    // init() as a task: the reset pulses and the sleep-out/display-on delays
+    // are delay() awaits, so an Executor can run the other panel meanwhile.
+    Task<> init_async();
+    void fill_color(uint16_t rgb565);
+
+    const InitReport& init_report() const { return init_report_; }
+
+    // Framebuffer drawing. Nothing reaches the panel until flush(), which
+    // streams only the damaged rectangles and returns the pixel bytes sent.
+    void set_pixel(uint16_t x, uint16_t y, uint16_t rgb565);
+    void fill_rect(int x, int y, int w, int h, uint16_t rgb565);
+    void draw_pixels(int x, int y, int w, int h, const uint16_t* rgb565);
+    // Converts 24/32-bit source pixels (`stride` bytes per row) straight into
+    // the framebuffer using the fastest RGB565 kernel this CPU supports,
+    // optionally dithering to hide RGB565 banding in gradients.
+    void blit(int x, int y, int w, int h, const uint8_t* src, size_t stride, PixelFormat fmt,
+              Dither dither = Dither::NONE);
+    void mark_dirty(const Rect& r);
+    size_t flush();
+
+    // Full-frame API with partial-update traffic: `frame` (host-order RGB565,
+    // PANEL_WIDTH x PANEL_HEIGHT) is tile-diffed against the previous one and
+    // only the changed windows are sent. Pending framebuffer damage is included.
+    void present(const uint16_t* frame);
+    const DiffStats& diff_stats() const { return diff_stats_; }
+
+    // Round mode clips every RAM window to the visible circle, splitting it
+    // into row bands that each cover only their rows' visible extent.
+    void set_round_mode(bool on) { round_mode_ = on; }
+    size_t round_bytes_skipped() const { return round_skipped_; }
+
+    const SpiStats& stats() const { return stats_; }
+    const TransferPlanner& planner() const { return planner_; }
+    const SpiBus::Client& bus_client() const { return bus_; }
+
+private:
+    void request_lines();
+
+    void set_pin(unsigned int offset, bool value);
+    void set_dc(bool dc, bool assert_cs);
+    void submit(bool leave_dc_high = false);
+
+    void ram_write_begin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1);
+    void write_pixels(const uint8_t* data, size_t bytes);
+    // Returns the pixel bytes actually sent, which round mode makes smaller
+    // than the window's area.
+    size_t write_window(const Rect& r);
+    void write_rect(const Rect& r);
+
+    static std::optional<Rect> clip(int x, int y, int w, int h);
+
+    ControlPins pins_;
+    std::string chip_;
+    std::optional<gpiod::line_request> request_;
+    SpiBus::Client& bus_;
+
+    TransferPlanner planner_;
+    SpiTransaction txn_;
+    SpiStats stats_;
+    InitReport init_report_;
+    bool cs_low_ = false;
+    int dc_level_ = -1;
+
+    // RGB565 in panel byte order (big-endian), row-major, so rows can be
+    // handed to the SPI layer without conversion.
+    std::vector<uint8_t> fb_;
+    std::vector<Rect> damage_;
+    size_t window_overhead_;
+
+    TileDiff diff_;
+    DiffStats diff_stats_;
+
+    bool round_mode_ = false;
+    size_t round_skipped_ = 0;
+};
+
+inline void Gc9Panel::request_lines() {
+    gpiod::chip chip(chip_);
+    gpiod::line_settings settings;
+    settings.set_direction(gpiod::line::direction::OUTPUT);
+    settings.set_output_value(gpiod::line::value::INACTIVE);
+
+    gpiod::line_config lcfg;
+    lcfg.add_line_settings(pins_.cs, settings);
+    lcfg.add_line_settings(pins_.dc, settings);
+    lcfg.add_line_settings(pins_.rst, settings);
+
+    gpiod::request_config rcfg;
+    rcfg.set_consumer("gc9-demo");
+
+    auto builder = chip.prepare_request();
+    builder.set_consumer("gc9-demo");
+    builder.set_line_config(lcfg);
+    request_ = builder.do_request();
+}
+
+inline void Gc9Panel::set_pin(unsigned int offset, bool value) {
+    if (!request_) {
+        throw std::runtime_error("GPIO lines not requested");
+    }
+
+    request_->set_value(offset, value ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE);
+    ++stats_.gpio_ioctls;
+
+    if (offset == pins_.cs) {
+        cs_low_ = !value;
+    } else if (offset == pins_.dc) {
+        dc_level_ = value;
+    }
+}
+
+inline void Gc9Panel::set_dc(bool dc, bool assert_cs) {
+    if (!request_) {
+        throw std::runtime_error("GPIO lines not requested");
+    }
+
+    // Skip the ioctl entirely when the lines are already where we want them,
+    // e.g. back-to-back pixel transactions inside one RAM write.
+    if ((!assert_cs || cs_low_) && dc_level_ == dc) {
+        return;
+    }
+
+    const auto dc_value = dc ? gpiod::line::value::ACTIVE : gpiod::line::value::INACTIVE;
+    if (assert_cs && !cs_low_) {
+        // CS low and DC in a single line-request ioctl.
+        request_->set_values({{pins_.cs, gpiod::line::value::INACTIVE}, {pins_.dc, dc_value}});
+        cs_low_ = true;
+    } else {
+        request_->set_value(pins_.dc, dc_value);
+    }
+    dc_level_ = dc;
+    ++stats_.gpio_ioctls;
+}
+
+inline void Gc9Panel::submit(bool leave_dc_high) {
+    auto lease = bus_.acquire();
+    txn_.submit(
+        bus_.fd(), planner_, [this](bool dc, bool first) { set_dc(dc, first); }, stats_,
+        leave_dc_high ? 1 : -1);
+}
+
+inline void Gc9Panel::ram_write_begin(uint16_t x0, uint16_t y0, uint16_t x1, uint16_t y1) {
+    // CASET/RASET/RAMWR go out as one transaction with CS held low throughout,
+    // and DC is left high so write_pixels() can stream straight into GRAM.
+    txn_.command(0x2A, {static_cast<uint8_t>(x0 >> 8), static_cast<uint8_t>(x0 & 0xFF),
+                        static_cast<uint8_t>(x1 >> 8), static_cast<uint8_t>(x1 & 0xFF)});
+    txn_.command(0x2B, {static_cast<uint8_t>(y0 >> 8), static_cast<uint8_t>(y0 & 0xFF),
+                        static_cast<uint8_t>(y1 >> 8), static_cast<uint8_t>(y1 & 0xFF)});
+    txn_.command(0x2C);
+    submit(true);
+}
+
+inline void Gc9Panel::write_pixels(const uint8_t* data, size_t bytes) {
+    auto lease = bus_.acquire();
+    planner_.write(bus_.fd(), data, bytes, stats_);
+}
+
+inline size_t Gc9Panel::write_window(const Rect& r) {
+    if (!round_mode_) {
+        write_rect(r);
+        return size_t(r.area()) * 2;
+    }
+
+    // Grow a band row by row while the off-circle bytes it drags along stay
+    // below the cost of opening another window; then emit it and start anew.
+    const auto& spans = visible_spans();
+    std::optional<Rect> band;
+    size_t band_visible = 0;
+    size_t sent = 0;
+
+    const auto emit = [&] {
+        if (band) {
+            write_rect(*band);
+            sent += size_t(band->area()) * 2;
+            band.reset();
+        }
+    };
+
+    for (uint16_t y = r.y0; y <= r.y1; ++y) {
+        const uint16_t x0 = std::max(r.x0, spans[y].x0);
+        const uint16_t x1 = std::min(r.x1, spans[y].x1);
+        if (x0 > x1) {
+            emit();
+            continue;
+        }
+
+        const Rect row{x0, y, x1, y};
+        if (band) {
+            const Rect grown = band->united(row);
+            const size_t waste = (size_t(grown.area()) - band_visible - row.area()) * 2;
+            if (waste <= window_overhead_) {
+                band = grown;
+                band_visible += row.area();
+                continue;
+            }
+            emit();
+        }
+        band = row;
+        band_visible = row.area();
+    }
+    emit();
+
+    round_skipped_ += size_t(r.area()) * 2 - sent;
+    return sent;
+}
+
+inline void Gc9Panel::write_rect(const Rect& r) {
+    // CS is a plain GPIO, so the bus stays ours until it is raised again.
+    auto lease = bus_.acquire();
+    ram_write_begin(r.x0, r.y0, r.x1, r.y1);
+
+    const size_t row_bytes = size_t(r.x1 - r.x0 + 1) * 2;
+    const size_t stride = size_t(PANEL_WIDTH) * 2;
+    const uint8_t* row = fb_.data() + r.y0 * stride + r.x0 * 2;
+
+    if (row_bytes == stride) {
+        // Full-width band: the rows are contiguous in the framebuffer.
+        write_pixels(row, row_bytes * (r.y1 - r.y0 + 1));
+    } else {
+        // DC is already high and CS low; the transaction packs the rows into
+        // bufsiz-sized messages, so each batch costs exactly one ioctl.
+        for (uint16_t y = r.y0; y <= r.y1; ++y, row += stride) {
+            txn_.data_ref(row, row_bytes);
+        }
+        submit(true);
+    }
+
+    set_pin(pins_.cs, true);
+}
+
+inline std::optional<Rect> Gc9Panel::clip(int x, int y, int w, int h) {
+    const int x0 = std::max(x, 0);
+    const int y0 = std::max(y, 0);
+    const int x1 = std::min(x + w, int(PANEL_WIDTH)) - 1;
+    const int y1 = std::min(y + h, int(PANEL_HEIGHT)) - 1;
+    if (w <= 0 || h <= 0 || x0 > x1 || y0 > y1) {
+        return std::nullopt;
+    }
+    return Rect{uint16_t(x0), uint16_t(y0), uint16_t(x1), uint16_t(y1)};
+}
+
+inline void Gc9Panel::set_pixel(uint16_t x, uint16_t y, uint16_t rgb565) {
+    if (x >= PANEL_WIDTH || y >= PANEL_HEIGHT) {
+        return;
+    }
+    uint8_t* px = fb_.data() + (size_t(y) * PANEL_WIDTH + x) * 2;
+    px[0] = rgb565 >> 8;
+    px[1] = rgb565 & 0xFF;
+    mark_dirty({x, y, x, y});
+}
+
+inline void Gc9Panel::fill_rect(int x, int y, int w, int h, uint16_t rgb565) {
+    const auto r = clip(x, y, w, h);
+    if (!r) {
+        return;
+    }
+
+    const size_t stride = size_t(PANEL_WIDTH) * 2;
+    uint8_t* first = fb_.data() + r->y0 * stride + r->x0 * 2;
+    for (uint16_t col = 0; col <= r->x1 - r->x0; ++col) {
+        first[col * 2] = rgb565 >> 8;
+        first[col * 2 + 1] = rgb565 & 0xFF;
+    }
+    const size_t row_bytes = size_t(r->x1 - r->x0 + 1) * 2;
+    for (uint8_t* row = first + stride; row <= fb_.data() + r->y1 * stride; row += stride) {
+        std::memcpy(row, first, row_bytes);
+    }
+    mark_dirty(*r);
+}
+
+inline void Gc9Panel::draw_pixels(int x, int y, int w, int h, const uint16_t* rgb565) {
+    const auto r = clip(x, y, w, h);
+    if (!r) {
+        return;
+    }
+
+    for (int row = r->y0; row <= r->y1; ++row) {
+        const uint16_t* src = rgb565 + size_t(row - y) * w + (r->x0 - x);
+        uint8_t* dst = fb_.data() + (size_t(row) * PANEL_WIDTH + r->x0) * 2;
+        for (int col = r->x0; col <= r->x1; ++col, ++src, dst += 2) {
+            dst[0] = *src >> 8;
+            dst[1] = *src & 0xFF;
+        }
+    }
+    mark_dirty(*r);
+}
+
+inline void Gc9Panel::blit(int x, int y, int w, int h, const uint8_t* src, size_t stride,
+                    PixelFormat fmt, Dither dither) {
+    const auto r = clip(x, y, w, h);
+    if (!r) {
+        return;
+    }
+
+    const uint8_t* first = src + size_t(r->y0 - y) * stride + (r->x0 - x) * bytes_per_pixel(fmt);
+    uint8_t* dst = fb_.data() + (size_t(r->y0) * PANEL_WIDTH + r->x0) * 2;
+    convert_to_rgb565(first, stride, fmt, dst, size_t(PANEL_WIDTH) * 2, r->x1 - r->x0 + 1,
+                              r->y1 - r->y0 + 1, dither, r->x0, r->y0);
+    mark_dirty(*r);
+}
+
+inline void Gc9Panel::mark_dirty(const Rect& r) {
+    // Absorb every rectangle the new one touches, repeating until stable since
+    // the grown rectangle may now reach others.
+    Rect merged = r;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (auto it = damage_.begin(); it != damage_.end(); ++it) {
+            if (merged.touches(*it)) {
+                merged = merged.united(*it);
+                damage_.erase(it);
+                changed = true;
+                break;
+            }
+        }
+    }
+    damage_.push_back(merged);
+
+    // Over budget: fuse the pair whose union adds the fewest extra pixels.
+    while (damage_.size() > MAX_DAMAGE_RECTS) {
+        size_t best_a = 0, best_b = 1;
+        uint32_t best_cost = UINT32_MAX;
+        for (size_t a = 0; a < damage_.size(); ++a) {
+            for (size_t b = a + 1; b < damage_.size(); ++b) {
+                const uint32_t cost =
+                    damage_[a].united(damage_[b]).area() - damage_[a].area() - damage_[b].area();
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_a = a;
+                    best_b = b;
+                }
+            }
+        }
+        damage_[best_a] = damage_[best_a].united(damage_[best_b]);
+        damage_.erase(damage_.begin() + best_b);
+    }
+}
+
+inline size_t Gc9Panel::flush() {
+    size_t bytes = 0;
+    for (const Rect& r : damage_) {
+        bytes += write_window(r);
+    }
+    damage_.clear();
+    return bytes;
+}
+
+inline void Gc9Panel::present(const uint16_t* frame) {
+    const auto& windows = diff_.diff(frame, damage_);
+    damage_.clear();
+
+    size_t bytes = 0;
+    for (const Rect& w : windows) {
+        for (int row = w.y0; row <= w.y1; ++row) {
+            const uint16_t* src = frame + size_t(row) * PANEL_WIDTH + w.x0;
+            uint8_t* dst = fb_.data() + (size_t(row) * PANEL_WIDTH + w.x0) * 2;
+            for (int col = w.x0; col <= w.x1; ++col, ++src, dst += 2) {
+                dst[0] = *src >> 8;
+                dst[1] = *src & 0xFF;
+            }
+        }
+        bytes += write_window(w);
+    }
+
+    constexpr size_t frame_bytes = size_t(PANEL_WIDTH) * PANEL_HEIGHT * 2;
+    diff_stats_.tiles_changed = diff_.changed_tiles();
+    diff_stats_.windows = windows.size();
+    diff_stats_.bytes_sent = bytes;
+    diff_stats_.bytes_saved = frame_bytes - bytes;
+    ++diff_stats_.frames;
+    diff_stats_.total_bytes_sent += bytes;
+    diff_stats_.total_bytes_saved += frame_bytes - bytes;
+}
+
+inline Task<> Gc9Panel::init_async() {
+    request_lines();
+
+    // hardware reset
+    set_pin(pins_.rst, false);
+    co_await delay(std::chrono::milliseconds(50));
+    set_pin(pins_.rst, true);
+    co_await delay(std::chrono::milliseconds(50));
+
+    init_report_ = co_await run_init(
+        GC9_INIT, txn_, stats_,
+        [this] {
+            auto lease = bus_.acquire();
+            submit();
+            set_pin(pins_.cs, true);
+        },
+        [](const char*) -> Task<> { co_return; });
+}
+
+inline void Gc9Panel::fill_color(uint16_t rgb565) {
+    // Keep the framebuffer in step with the panel so later flushes stay valid.
+    for (size_t i = 0; i < fb_.size(); i += 2) {
+        fb_[i] = rgb565 >> 8;
+        fb_[i + 1] = rgb565 & 0xFF;
+    }
+    damage_.clear();
+    diff_.invalidate();
+
+    // The framebuffer now holds the frame contiguously, so a full-panel window
+    // streams it in bufsiz-sized messages (or row bands in round mode).
+    write_window({0, 0, PANEL_WIDTH - 1, PANEL_HEIGHT - 1});
+}
+
+}  // namespace pidisp::gc9
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gc9_panel.hpp"
+
+namespace pidisp::gc9 {
+
+// Decouples rendering from SPI streaming: the application renders frame N+1
+// into a back buffer while a dedicated thread pushes frame N through
+// Gc9Panel::present(). Three slots are handed over with atomics only.
+//
+// MAILBOX never blocks the renderer: a frame that is superseded before the
+// flush thread picks it up is dropped (counted). FIFO shows every frame in
+// order and blocks begin_frame() while QUEUE_DEPTH frames are in flight.
+//
+// Buffers are recycled, so callers must redraw the whole frame each time.
+// While the presenter exists, the panel belongs to its flush thread.
+class AsyncPresenter {
+public:
+    enum class Mode { MAILBOX, FIFO };
+
+    static constexpr size_t QUEUE_DEPTH = 3;
+
+    struct Stats {
+        uint64_t presented;
+        uint64_t dropped;
+        uint64_t latency_last_us;  // submit() to end of present()
+        uint64_t latency_max_us;
+        uint64_t latency_avg_us;
+    };
+
+    AsyncPresenter(Gc9Panel& panel, Mode mode);
+    ~AsyncPresenter();
+
+    AsyncPresenter(const AsyncPresenter&) = delete;
+    AsyncPresenter& operator=(const AsyncPresenter&) = delete;
+
+    // Host-order RGB565 back buffer, PANEL_WIDTH x PANEL_HEIGHT. Both calls
+    // rethrow a failure of the flush thread.
+    uint16_t* begin_frame();
+    void submit();
+
+    // Polls readable once frames have reached the panel; collect() returns
+    // how many since the last call, so an Executor task can
+    // `co_await readable(presenter.presented_fd(), ...)` for completions.
+    int presented_fd() const { return presented_fd_; }
+    uint64_t collect();
+
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Slot {
+        std::vector<uint16_t> pixels = std::vector<uint16_t>(size_t(PANEL_WIDTH) * PANEL_HEIGHT);
+        Clock::time_point submitted;
+    };
+
+    static constexpr uint8_t FRESH = 0x4;  // mailbox: middle slot holds an unseen frame
+
+    void run();
+    int take();
+    void check() const;
+    void signal_presented();
+
+    Gc9Panel& panel_;
+    Mode mode_;
+    std::array<Slot, QUEUE_DEPTH> slots_;
+    int presented_fd_;
+
+    // MAILBOX: classic triple buffer. back_ belongs to the renderer, front_ to
+    // the flush thread, and middle_ is swapped between them.
+    uint8_t back_ = 0;
+    uint8_t front_ = 1;
+    std::atomic<uint8_t> middle_{2};
+
+    // FIFO: single-producer/single-consumer ring over the same slots.
+    std::atomic<uint32_t> head_{0};
+    std::atomic<uint32_t> tail_{0};
+
+    std::atomic<uint32_t> published_{0};  // futex word the flush thread sleeps on
+    std::atomic<bool> stop_{false};
+
+    // Set once by the flush thread, which then exits; error_ is published by
+    // the release store to failed_.
+    std::exception_ptr error_;
+    std::atomic<bool> failed_{false};
+
+    std::atomic<uint64_t> presented_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> latency_last_us_{0};
+    std::atomic<uint64_t> latency_max_us_{0};
+    std::atomic<uint64_t> latency_total_us_{0};
+
+    std::thread thread_;
+};
+
+inline AsyncPresenter::AsyncPresenter(Gc9Panel& panel, Mode mode)
+    : panel_(panel), mode_(mode), presented_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (presented_fd_ < 0) {
+        throw std::runtime_error("eventfd failed: " + std::string(std::strerror(errno)));
+    }
+    thread_ = std::thread([this] { run(); });
+}
+
+inline AsyncPresenter::~AsyncPresenter() {
+    stop_.store(true);
+    published_.fetch_add(1);
+    published_.notify_one();
+    head_.notify_all();
+    thread_.join();
+    close(presented_fd_);
+}
+
+inline void AsyncPresenter::check() const {
+    if (failed_.load(std::memory_order_acquire)) {
+        std::rethrow_exception(error_);
+    }
+}
+
+inline uint16_t* AsyncPresenter::begin_frame() {
+    check();
+    if (mode_ == Mode::MAILBOX) {
+        return slots_[back_].pixels.data();
+    }
+
+    // FIFO: wait for a free slot; the flush thread bumps head_ after each frame.
+    const uint32_t tail = tail_.load(std::memory_order_relaxed);
+    for (uint32_t head = head_.load(std::memory_order_acquire); tail - head >= slots_.size();
+         head = head_.load(std::memory_order_acquire)) {
+        head_.wait(head);
+        check();
+    }
+    return slots_[tail % slots_.size()].pixels.data();
+}
+
+inline void AsyncPresenter::submit() {
+    check();
+    if (mode_ == Mode::MAILBOX) {
+        slots_[back_].submitted = Clock::now();
+        const uint8_t prev = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel);
+        if (prev & FRESH) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+        back_ = prev & ~FRESH;
+    } else {
+        const uint32_t tail = tail_.load(std::memory_order_relaxed);
+        slots_[tail % slots_.size()].submitted = Clock::now();
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    published_.fetch_add(1, std::memory_order_release);
+    published_.notify_one();
+}
+
+inline uint64_t AsyncPresenter::collect() {
+    uint64_t count = 0;
+    if (read(presented_fd_, &count, sizeof(count)) != ssize_t(sizeof(count))) {
+        count = 0;
+    }
+    check();
+    return count;
+}
+
+inline void AsyncPresenter::signal_presented() {
+    const uint64_t one = 1;
+    [[maybe_unused]] const ssize_t n = write(presented_fd_, &one, sizeof(one));
+}
+
+// Flush-thread side: index of the next frame to present, or -1 if none.
+inline int AsyncPresenter::take() {
+    if (mode_ == Mode::MAILBOX) {
+        if (!(middle_.load(std::memory_order_acquire) & FRESH)) {
+            return -1;
+        }
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & ~FRESH;
+        return front_;
+    }
+
+    const uint32_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) {
+        return -1;
+    }
+    return head % slots_.size();
+}
+
+inline void AsyncPresenter::run() {
+    // Frames already submitted when the presenter is destroyed still go out.
+    for (;;) {
+        const uint32_t seen = published_.load(std::memory_order_acquire);
+        const int slot = take();
+        if (slot < 0) {
+            if (stop_.load()) {
+                break;
+            }
+            published_.wait(seen);
+            continue;
+        }
+
+        try {
+            panel_.present(slots_[slot].pixels.data());
+        } catch (...) {
+            // Wake whoever might be waiting so the failure surfaces there;
+            // head_ has to change for a blocked begin_frame() to return.
+            error_ = std::current_exception();
+            failed_.store(true, std::memory_order_release);
+            head_.fetch_add(1, std::memory_order_release);
+            head_.notify_all();
+            signal_presented();
+            return;
+        }
+
+        const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+                                 Clock::now() - slots_[slot].submitted)
+                                 .count();
+        latency_last_us_.store(latency, std::memory_order_relaxed);
+        latency_total_us_.fetch_add(latency, std::memory_order_relaxed);
+        if (uint64_t(latency) > latency_max_us_.load(std::memory_order_relaxed)) {
+            latency_max_us_.store(latency, std::memory_order_relaxed);
+        }
+        presented_.fetch_add(1, std::memory_order_relaxed);
+
+        if (mode_ == Mode::FIFO) {
+            head_.fetch_add(1, std::memory_order_release);
+            head_.notify_all();
+        }
+        signal_presented();
+    }
+}
+
+inline AsyncPresenter::Stats AsyncPresenter::stats() const {
+    const uint64_t presented = presented_.load(std::memory_order_relaxed);
+    return {
+        presented,
+        dropped_.load(std::memory_order_relaxed),
+        latency_last_us_.load(std::memory_order_relaxed),
+        latency_max_us_.load(std::memory_order_relaxed),
+        presented ? latency_total_us_.load(std::memory_order_relaxed) / presented : 0,
+    };
+}
+
+}  // namespace pidisp::gc9
@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "mono_canvas.hpp"
+#include "mono_convert.hpp"
+#include "mono_rotate.hpp"
+
+namespace {
+
+constexpr int WIDTH = 128;  // 2.9" EPD
+constexpr int HEIGHT = 296;
+constexpr size_t STRIDE = WIDTH / 8;
+constexpr int ITERATIONS = 20000;
+
+// The per-pixel loop every primitive used to be written as.
+void put_pixel(uint8_t* buf, int x, int y, bool white) {
+    const size_t bit_index = size_t(y) * WIDTH + x;
+    const uint8_t mask = 0x80 >> (bit_index % 8);
+    if (white) {
+        buf[bit_index / 8] |= mask;
+    } else {
+        buf[bit_index / 8] &= ~mask;
+    }
+}
+
+bool get_bit(const uint8_t* buf, size_t stride, int x, int y) {
+    return buf[y * stride + x / 8] & (0x80 >> (x % 8));
+}
+
+void stripes_per_pixel(uint8_t* buf) {
+    for (int row = 0; row < HEIGHT; ++row) {
+        const bool black_row = (row / 16) % 2 == 0;
+        for (int col = 0; col < WIDTH; ++col) {
+            put_pixel(buf, col, row, !black_row);
+        }
+    }
+}
+
+void stripes_canvas(uint8_t* buf) {
+    pidisp::MonoCanvas canvas(buf, WIDTH, HEIGHT);
+    for (int row = 0; row < HEIGHT; row += 16) {
+        canvas.fill_rect(0, row, WIDTH, 16, (row / 16) % 2 != 0);
+    }
+}
+
+// Unaligned boxes, as for text backgrounds.
+void boxes_per_pixel(uint8_t* buf) {
+    for (int i = 0; i < 8; ++i) {
+        for (int y = 5 + i * 35; y < 5 + i * 35 + 30; ++y) {
+            for (int x = 3 + i; x < 3 + i + 97; ++x) {
+                put_pixel(buf, x, y, i % 2);
+            }
+        }
+    }
+}
+
+void boxes_canvas(uint8_t* buf) {
+    pidisp::MonoCanvas canvas(buf, WIDTH, HEIGHT);
+    for (int i = 0; i < 8; ++i) {
+        canvas.fill_rect(3 + i, 5 + i * 35, 97, 30, i % 2);
+    }
+}
+
+void blit_per_pixel(uint8_t* buf, const uint8_t* src, const uint8_t* mask, size_t src_stride, int w,
+                    int h, int x0, int y0) {
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            if (get_bit(mask, src_stride, x, y)) {
+                put_pixel(buf, x0 + x, y0 + y, get_bit(src, src_stride, x, y));
+            }
+        }
+    }
+}
+
+template <typename Fn>
+double time_us(Fn&& fn, uint8_t* buf) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; ++i) {
+        fn();
+        asm volatile("" : : "r"(buf) : "memory");
+    }
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+           ITERATIONS;
+}
+
+void report(const char* name, double pixel_us, double word_us, bool ok) {
+    std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(2)
+              << std::setw(9) << pixel_us << " us/pixel loop " << std::setw(8) << word_us
+              << " us/word-wise  x" << std::setprecision(1) << pixel_us / word_us
+              << (ok ? "" : "  MISMATCH") << "\n";
+}
+
+}  // namespace
+
+int main() {
+    std::vector<uint8_t> a(STRIDE * HEIGHT, 0xFF);
+    std::vector<uint8_t> b(STRIDE * HEIGHT, 0xFF);
+    std::cout << WIDTH << "x" << HEIGHT << " 1bpp, " << ITERATIONS << " iterations\n";
+
+    stripes_per_pixel(a.data());
+    stripes_canvas(b.data());
+    report("stripes", time_us([&] { stripes_per_pixel(a.data()); }, a.data()),
+           time_us([&] { stripes_canvas(b.data()); }, b.data()), a == b);
+
+    std::fill(a.begin(), a.end(), 0xFF);
+    std::fill(b.begin(), b.end(), 0xFF);
+    boxes_per_pixel(a.data());
+    boxes_canvas(b.data());
+    report("unaligned boxes", time_us([&] { boxes_per_pixel(a.data()); }, a.data()),
+           time_us([&] { boxes_canvas(b.data()); }, b.data()), a == b);
+
+    // A random 100x40 sprite with a random mask, blitted at an odd x so every
+    // destination byte straddles two source bytes.
+    constexpr int SW = 100;
+    constexpr int SH = 40;
+    constexpr size_t SSTRIDE = (SW + 7) / 8;
+    std::mt19937 rng(7);
+    std::vector<uint8_t> sprite(SSTRIDE * SH);
+    std::vector<uint8_t> mask(SSTRIDE * SH);
+    for (size_t i = 0; i < sprite.size(); ++i) {
+        sprite[i] = rng();
+        mask[i] = rng();
+    }
+    pidisp::MonoCanvas canvas(b.data(), WIDTH, HEIGHT);
+    blit_per_pixel(a.data(), sprite.data(), mask.data(), SSTRIDE, SW, SH, 13, 50);
+    canvas.blit(13, 50, sprite.data(), SSTRIDE, SW, SH, mask.data());
+    report("masked blit",
+           time_us([&] { blit_per_pixel(a.data(), sprite.data(), mask.data(), SSTRIDE, SW, SH, 13, 50); },
+                   a.data()),
+           time_us([&] { canvas.blit(13, 50, sprite.data(), SSTRIDE, SW, SH, mask.data()); }, b.data()),
+           a == b);
+
+    // Clipping: the part hanging off the right and top edges is dropped.
+    std::fill(a.begin(), a.end(), 0x00);
+    std::fill(b.begin(), b.end(), 0x00);
+    for (int y = 0; y < SH; ++y) {
+        for (int x = 0; x < SW; ++x) {
+            const int dx = 70 + x;
+            const int dy = -10 + y;
+            if (dx < WIDTH && dy >= 0) {
+                put_pixel(a.data(), dx, dy, get_bit(sprite.data(), SSTRIDE, x, y));
+            }
+        }
+    }
+    canvas.blit(70, -10, sprite.data(), SSTRIDE, SW, SH);
+    std::cout << "clipped blit    " << (a == b ? "ok" : "MISMATCH") << "\n";
+
+    // Gray to 1bpp: every packing kernel against scalar, then each mode.
+    std::vector<uint8_t> gray(size_t(WIDTH) * HEIGHT);
+    for (auto& px : gray) {
+        px = rng();
+    }
+    std::cout << "\nGray to 1bpp, " << WIDTH << "x" << HEIGHT << "\n";
+    const auto kernels = pidisp::mono_kernels();
+    double scalar_us = 0;
+    for (const auto& kernel : kernels) {
+        // Odd widths exercise the scalar tails of the vector kernels.
+        for (size_t n : {size_t(WIDTH), size_t(WIDTH - 5), size_t(37)}) {
+            kernels.front().pack(gray.data(), a.data(), n, pidisp::bayer8_row(3));
+            kernel.pack(gray.data(), b.data(), n, pidisp::bayer8_row(3));
+            if (!std::equal(a.begin(), a.begin() + (n + 7) / 8, b.begin())) {
+                std::cout << kernel.name << " MISMATCH at width " << n << "\n";
+            }
+        }
+        const double us = time_us(
+            [&] {
+                for (int y = 0; y < HEIGHT; ++y) {
+                    kernel.pack(gray.data() + y * WIDTH, b.data() + y * STRIDE, WIDTH,
+                                pidisp::bayer8_row(y));
+                }
+            },
+            b.data());
+        if (!scalar_us) {
+            scalar_us = us;
+        }
+        std::cout << std::left << std::setw(16) << kernel.name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(9) << us << " us/frame  x" << std::setprecision(1)
+                  << scalar_us / us << "\n";
+    }
+
+    for (auto [mode, name] : {std::pair{pidisp::MonoDither::THRESHOLD, "threshold"},
+                              std::pair{pidisp::MonoDither::ORDERED, "ordered"},
+                              std::pair{pidisp::MonoDither::ATKINSON, "atkinson"},
+                              std::pair{pidisp::MonoDither::FLOYD_STEINBERG, "floyd-steinberg"}}) {
+        const double us = time_us(
+            [&] { pidisp::gray_to_mono(gray.data(), WIDTH, b.data(), STRIDE, WIDTH, HEIGHT, mode); },
+            b.data());
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(9) << us << " us/frame\n";
+    }
+
+    // 4-level gray: split a packed 2bpp frame into the panel's two planes.
+    std::vector<uint8_t> gray4(STRIDE * 2 * HEIGHT);
+    for (auto& byte : gray4) {
+        byte = rng();
+    }
+    std::vector<uint8_t> lo_a(STRIDE * HEIGHT);
+    std::vector<uint8_t> lo_b(STRIDE * HEIGHT);
+    const size_t pixels = size_t(WIDTH) * HEIGHT;
+    pidisp::detail::split_gray4_naive(gray4.data(), a.data(), lo_a.data(), pixels);
+    pidisp::split_gray4(gray4.data(), b.data(), lo_b.data(), pixels);
+    const bool planes_ok = a == b && lo_a == lo_b;
+    pidisp::detail::split_gray4_naive(gray4.data(), a.data(), lo_a.data(), 45);
+    pidisp::split_gray4(gray4.data(), b.data(), lo_b.data(), 45);
+    report("gray4 planes",
+           time_us([&] { pidisp::detail::split_gray4_naive(gray4.data(), a.data(), lo_a.data(), pixels); },
+                   a.data()),
+           time_us([&] { pidisp::split_gray4(gray4.data(), b.data(), lo_b.data(), pixels); }, b.data()),
+           planes_ok && std::equal(a.begin(), a.begin() + 6, b.begin()) &&
+               std::equal(lo_a.begin(), lo_a.begin() + 6, lo_b.begin()));
+
+    // Landscape 296x128 content rotated onto the portrait panel, and the
+    // 180-degree flip in place of the panel's own orientation.
+    std::cout << "\nRotation, landscape " << HEIGHT << "x" << WIDTH << "\n";
+    constexpr size_t LSTRIDE = HEIGHT / 8;
+    std::vector<uint8_t> landscape(LSTRIDE * WIDTH);
+    for (auto& byte : landscape) {
+        byte = rng();
+    }
+    for (auto [rot, name] : {std::pair{pidisp::Rotation::R90, "rotate 90"},
+                             std::pair{pidisp::Rotation::R180, "rotate 180"},
+                             std::pair{pidisp::Rotation::R270, "rotate 270"}}) {
+        const bool quarter = rot != pidisp::Rotation::R180;
+        const size_t dst_stride = quarter ? STRIDE : LSTRIDE;
+        pidisp::detail::rotate_mono_naive(landscape.data(), HEIGHT, WIDTH, LSTRIDE, a.data(), dst_stride,
+                                          rot);
+        pidisp::rotate_mono(landscape.data(), HEIGHT, WIDTH, LSTRIDE, b.data(), dst_stride, rot);
+        report(name,
+               time_us(
+                   [&] {
+                       pidisp::detail::rotate_mono_naive(landscape.data(), HEIGHT, WIDTH, LSTRIDE,
+                                                         a.data(), dst_stride, rot);
+                   },
+                   a.data()),
+               time_us(
+                   [&] {
+                       pidisp::rotate_mono(landscape.data(), HEIGHT, WIDTH, LSTRIDE, b.data(), dst_stride,
+                                           rot);
+                   },
+                   b.data()),
+               a == b);
+    }
+
+    return 0;
+}
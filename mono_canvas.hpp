@@ -0,0 +1,226 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace pidisp {
+
+namespace detail {
+
+// MSB-first bitmaps read as big-endian words: pixel 0 of the word is bit 63.
+inline uint64_t load_be64(const uint8_t* p) {
+    uint64_t w;
+    std::memcpy(&w, p, 8);
+    if constexpr (std::endian::native == std::endian::little) {
+        w = __builtin_bswap64(w);
+    }
+    return w;
+}
+
+inline void store_be64(uint8_t* p, uint64_t w) {
+    if constexpr (std::endian::native == std::endian::little) {
+        w = __builtin_bswap64(w);
+    }
+    std::memcpy(p, &w, 8);
+}
+
+// The 64 pixels of `row` starting at bit `pos`, MSB first. Pixels past the
+// end of the row read as zero.
+inline uint64_t load_bits(const uint8_t* row, size_t row_bytes, size_t pos) {
+    const size_t byte = pos / 8;
+    const unsigned shift = pos % 8;
+    uint8_t buf[9] = {};
+    const uint8_t* p = row + byte;
+    if (row_bytes - byte < 9) {
+        std::memcpy(buf, p, row_bytes - byte);
+        p = buf;
+    }
+    uint64_t w = load_be64(p) << shift;
+    if (shift) {
+        w |= p[8] >> (8 - shift);
+    }
+    return w;
+}
+
+// Writes the pixels of `value` selected by `mask` at bit `pos`. Mask bits
+// must not extend past the end of the row.
+inline void store_bits(uint8_t* row, size_t row_bytes, size_t pos, uint64_t value, uint64_t mask) {
+    const size_t byte = pos / 8;
+    const unsigned shift = pos % 8;
+    const size_t n = row_bytes - byte;
+    uint8_t buf[9] = {};
+    uint8_t* p = row + byte;
+    if (n < 9) {
+        std::memcpy(buf, p, n);
+        p = buf;
+    }
+
+    value &= mask;
+    const uint64_t w = load_be64(p);
+    store_be64(p, (w & ~(mask >> shift)) | (value >> shift));
+    if (shift) {
+        const uint8_t m = uint8_t(mask << (8 - shift));
+        p[8] = (p[8] & ~m) | uint8_t(value << (8 - shift));
+    }
+    if (p == buf) {
+        std::memcpy(row + byte, buf, n);
+    }
+}
+
+// Top `n` bits set, 0 <= n <= 64.
+inline uint64_t leading_mask(unsigned n) {
+    return n >= 64 ? ~uint64_t(0) : ~(~uint64_t(0) >> n);
+}
+
+}  // namespace detail
+
+// Drawing view over a packed 1bpp bitmap in panel layout: rows of
+// `stride` bytes, MSB = leftmost pixel, 1 = white. Does not own the pixels,
+// so it can draw straight into the buffer a driver sends.
+//
+// Everything clips to the bitmap. Horizontal spans touch at most two partial
+// bytes and memset the rest, and blits move 64 pixels per step regardless of
+// alignment.
+class MonoCanvas {
+public:
+    MonoCanvas(uint8_t* data, int width, int height, size_t stride = 0)
+        : data_(data), width_(width), height_(height), stride_(stride ? stride : (width + 7) / 8) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t stride() const { return stride_; }
+    uint8_t* row(int y) const { return data_ + size_t(y) * stride_; }
+
+    void fill(bool white) { std::memset(data_, white ? 0xFF : 0x00, stride_ * height_); }
+
+    bool get_pixel(int x, int y) const {
+        if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+            return false;
+        }
+        return row(y)[x / 8] & (0x80 >> (x % 8));
+    }
+
+    void set_pixel(int x, int y, bool white) {
+        if (x < 0 || y < 0 || x >= width_ || y >= height_) {
+            return;
+        }
+        uint8_t& byte = row(y)[x / 8];
+        const uint8_t bit = 0x80 >> (x % 8);
+        byte = white ? (byte | bit) : (byte & ~bit);
+    }
+
+    // Pixels [x0, x1] of row y, inclusive.
+    void hspan(int x0, int x1, int y, bool white) {
+        if (y < 0 || y >= height_) {
+            return;
+        }
+        x0 = std::max(x0, 0);
+        x1 = std::min(x1, width_ - 1);
+        if (x0 > x1) {
+            return;
+        }
+        span_bytes(row(y), x0, x1, white ? 0xFF : 0x00);
+    }
+
+    void vspan(int x, int y0, int y1, bool white) {
+        if (x < 0 || x >= width_) {
+            return;
+        }
+        y0 = std::max(y0, 0);
+        y1 = std::min(y1, height_ - 1);
+        const uint8_t bit = 0x80 >> (x % 8);
+        for (int y = y0; y <= y1; ++y) {
+            uint8_t& byte = row(y)[x / 8];
+            byte = white ? (byte | bit) : (byte & ~bit);
+        }
+    }
+
+    void fill_rect(int x, int y, int w, int h, bool white) {
+        int x0 = std::max(x, 0);
+        int y0 = std::max(y, 0);
+        int x1 = std::min(x + w, width_) - 1;
+        int y1 = std::min(y + h, height_) - 1;
+        if (x0 > x1 || y0 > y1) {
+            return;
+        }
+        const uint8_t fill = white ? 0xFF : 0x00;
+        // Whole rows of a tightly packed bitmap are one contiguous run.
+        if (x0 == 0 && x1 == width_ - 1 && width_ % 8 == 0 && stride_ == size_t(width_ / 8)) {
+            std::memset(row(y0), fill, stride_ * (y1 - y0 + 1));
+            return;
+        }
+        for (int yy = y0; yy <= y1; ++yy) {
+            span_bytes(row(yy), x0, x1, fill);
+        }
+    }
+
+    void draw_rect(int x, int y, int w, int h, bool white) {
+        if (w <= 0 || h <= 0) {
+            return;
+        }
+        hspan(x, x + w - 1, y, white);
+        hspan(x, x + w - 1, y + h - 1, white);
+        vspan(x, y + 1, y + h - 2, white);
+        vspan(x + w - 1, y + 1, y + h - 2, white);
+    }
+
+    // Copies a w x h 1bpp bitmap (same layout, `src_stride` bytes per row) to
+    // (x, y). With a `mask` bitmap of the same shape, only pixels whose mask
+    // bit is set are written, e.g. glyphs over a background.
+    void blit(int x, int y, const uint8_t* src, size_t src_stride, int w, int h,
+              const uint8_t* mask = nullptr, size_t mask_stride = 0) {
+        const int sx = std::max(0, -x);
+        const int sy = std::max(0, -y);
+        const int dx = std::max(x, 0);
+        const int dy = std::max(y, 0);
+        const int cw = std::min(x + w, width_) - dx;
+        const int ch = std::min(y + h, height_) - dy;
+        if (cw <= 0 || ch <= 0) {
+            return;
+        }
+        if (mask && !mask_stride) {
+            mask_stride = src_stride;
+        }
+
+        for (int row_index = 0; row_index < ch; ++row_index) {
+            const uint8_t* src_row = src + size_t(sy + row_index) * src_stride;
+            const uint8_t* mask_row = mask ? mask + size_t(sy + row_index) * mask_stride : nullptr;
+            uint8_t* dst_row = row(dy + row_index);
+            for (int done = 0; done < cw; done += 64) {
+                const unsigned n = std::min(64, cw - done);
+                uint64_t bits_mask = detail::leading_mask(n);
+                if (mask_row) {
+                    bits_mask &= detail::load_bits(mask_row, mask_stride, sx + done);
+                }
+                const uint64_t value = detail::load_bits(src_row, src_stride, sx + done);
+                detail::store_bits(dst_row, stride_, dx + done, value, bits_mask);
+            }
+        }
+    }
+
+private:
+    static void span_bytes(uint8_t* row, int x0, int x1, uint8_t fill) {
+        const int b0 = x0 / 8;
+        const int b1 = x1 / 8;
+        const uint8_t head = 0xFF >> (x0 % 8);
+        const uint8_t tail = 0xFF << (7 - x1 % 8);
+        if (b0 == b1) {
+            const uint8_t m = head & tail;
+            row[b0] = (row[b0] & ~m) | (fill & m);
+            return;
+        }
+        row[b0] = (row[b0] & ~head) | (fill & head);
+        std::memset(row + b0 + 1, fill, b1 - b0 - 1);
+        row[b1] = (row[b1] & ~tail) | (fill & tail);
+    }
+
+    uint8_t* data_;
+    int width_;
+    int height_;
+    size_t stride_;
+};
+
+}  // namespace pidisp
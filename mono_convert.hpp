@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "mono_canvas.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIDISP_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define PIDISP_NEON 1
+#endif
+
+namespace pidisp {
+
+enum class MonoDither { THRESHOLD, ORDERED, ATKINSON, FLOYD_STEINBERG };
+
+// Packs `n` 8-bit gray pixels into MSB-first 1bpp, the layout the EPD
+// expects: a pixel is white (1) when gray >= thresholds[x % 8]. Writes
+// ceil(n / 8) bytes; padding bits in the last byte are white.
+using PackRowFn = void (*)(const uint8_t* gray, uint8_t* dst, size_t n, const uint8_t* thresholds);
+
+struct MonoKernel {
+    const char* name;
+    PackRowFn pack;
+};
+
+namespace detail {
+
+inline void pack_mono_scalar(const uint8_t* gray, uint8_t* dst, size_t n, const uint8_t* thresholds) {
+    for (size_t i = 0; i < n; i += 8) {
+        const size_t m = std::min<size_t>(8, n - i);
+        uint8_t byte = 0xFF >> m;
+        for (size_t b = 0; b < m; ++b) {
+            byte |= uint8_t(gray[i + b] >= thresholds[b]) << (7 - b);
+        }
+        dst[i / 8] = byte;
+    }
+}
+
+#ifdef PIDISP_X86
+
+// movemask puts lane 0 in bit 0, but the panel wants the leftmost pixel in
+// bit 7, so pixels are reversed within each 8-byte group before comparing.
+// The threshold pattern is stored reversed to match. Unsigned >= is
+// max(g, t) == g.
+
+__attribute__((target("sse2"))) void pack_mono_sse2(const uint8_t* gray, uint8_t* dst, size_t n,
+                                                    const uint8_t* t) {
+    const __m128i thr = _mm_setr_epi8(t[7], t[6], t[5], t[4], t[3], t[2], t[1], t[0], t[7], t[6], t[5],
+                                      t[4], t[3], t[2], t[1], t[0]);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gray + i));
+        g = _mm_shufflehi_epi16(_mm_shufflelo_epi16(g, 0x1B), 0x1B);
+        g = _mm_or_si128(_mm_slli_epi16(g, 8), _mm_srli_epi16(g, 8));
+        const uint16_t bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(g, thr), g));
+        std::memcpy(dst + i / 8, &bits, 2);
+    }
+    pack_mono_scalar(gray + i, dst + i / 8, n - i, t);
+}
+
+__attribute__((target("avx2"))) void pack_mono_avx2(const uint8_t* gray, uint8_t* dst, size_t n,
+                                                    const uint8_t* t) {
+    const __m256i reverse = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6,
+                                             5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    int64_t p;
+    std::memcpy(&p, t, 8);
+    const __m256i thr = _mm256_shuffle_epi8(_mm256_set1_epi64x(p), reverse);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i g = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(gray + i));
+        g = _mm256_shuffle_epi8(g, reverse);
+        const uint32_t bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(g, thr), g));
+        std::memcpy(dst + i / 8, &bits, 4);
+    }
+    pack_mono_sse2(gray + i, dst + i / 8, n - i, t);
+}
+
+#endif  // PIDISP_X86
+
+#ifdef PIDISP_NEON
+
+// NEON has no movemask: each lane's compare result is ANDed with its bit
+// weight and the eight lanes of each byte are summed with pairwise adds.
+inline void pack_mono_neon(const uint8_t* gray, uint8_t* dst, size_t n, const uint8_t* t) {
+    static const uint8_t WEIGHTS[16] = {128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1};
+    const uint8x16_t weights = vld1q_u8(WEIGHTS);
+    const uint8x8_t t8 = vld1_u8(t);
+    const uint8x16_t thr = vcombine_u8(t8, t8);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16_t white = vcgeq_u8(vld1q_u8(gray + i), thr);
+        const uint8x16_t bits = vandq_u8(white, weights);
+        uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+        sum = vpadd_u8(sum, sum);
+        sum = vpadd_u8(sum, sum);
+        // Byte stores: dst + i / 8 need not be 2-byte aligned.
+        vst1_lane_u8(dst + i / 8, sum, 0);
+        vst1_lane_u8(dst + i / 8 + 1, sum, 1);
+    }
+    pack_mono_scalar(gray + i, dst + i / 8, n - i, t);
+}
+
+#endif  // PIDISP_NEON
+
+}  // namespace detail
+
+// Every kernel this CPU can run, slowest first; the scalar loop is always there.
+inline std::vector<MonoKernel> mono_kernels() {
+    std::vector<MonoKernel> kernels{{"scalar", detail::pack_mono_scalar}};
+#ifdef PIDISP_X86
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.push_back({"sse2", detail::pack_mono_sse2});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", detail::pack_mono_avx2});
+    }
+#endif
+#ifdef PIDISP_NEON
+    kernels.push_back({"neon", detail::pack_mono_neon});
+#endif
+    return kernels;
+}
+
+inline const MonoKernel& best_mono_kernel() {
+    static const MonoKernel best = mono_kernels().back();
+    return best;
+}
+
+// 8x8 Bayer thresholds spread over 2..254, so 0 stays black and 255 white.
+inline const uint8_t* bayer8_row(size_t y) {
+    static const auto table = [] {
+        static constexpr uint8_t BAYER[8][8] = {
+            {0, 32, 8, 40, 2, 34, 10, 42},   {48, 16, 56, 24, 50, 18, 58, 26},
+            {12, 44, 4, 36, 14, 46, 6, 38},  {60, 28, 52, 20, 62, 30, 54, 22},
+            {3, 35, 11, 43, 1, 33, 9, 41},   {51, 19, 59, 27, 49, 17, 57, 25},
+            {15, 47, 7, 39, 13, 45, 5, 37},  {63, 31, 55, 23, 61, 29, 53, 21}};
+        std::array<std::array<uint8_t, 8>, 8> t{};
+        for (size_t r = 0; r < 8; ++r) {
+            for (size_t c = 0; c < 8; ++c) {
+                t[r][c] = BAYER[r][c] * 4 + 2;
+            }
+        }
+        return t;
+    }();
+    return table[y & 7].data();
+}
+
+// Error diffusion to 1bpp, Atkinson or Floyd-Steinberg. Rows must be fed top
+// to bottom. Atkinson spreads only 6/8 of the error, which keeps highlights
+// and shadows clean at the cost of some midtone contrast; it usually looks
+// better on e-paper. Floyd-Steinberg carries all of it forward.
+class MonoDiffuser {
+public:
+    MonoDiffuser(MonoDither kind, size_t width)
+        : kind_(kind), width_(width), rows_{std::vector<int16_t>(width + 4), std::vector<int16_t>(width + 4),
+                                            std::vector<int16_t>(width + 4)} {}
+
+    void reset() {
+        for (auto& row : rows_) {
+            std::fill(row.begin(), row.end(), 0);
+        }
+    }
+
+    void convert_row(const uint8_t* gray, uint8_t* dst) {
+        // Two guard entries on each side so the kernels never bounds-check.
+        int16_t* cur = rows_[0].data() + 2;
+        int16_t* next = rows_[1].data() + 2;
+        int16_t* next2 = rows_[2].data() + 2;
+
+        std::memset(dst, 0xFF, (width_ + 7) / 8);
+        for (size_t x = 0; x < width_; ++x) {
+            const int want = gray[x] + cur[x];
+            const bool white = want >= 128;
+            if (!white) {
+                dst[x / 8] &= ~(0x80 >> (x % 8));
+            }
+            const int err = want - (white ? 255 : 0);
+            if (kind_ == MonoDither::ATKINSON) {
+                const int e = err / 8;
+                cur[x + 1] += e;
+                cur[x + 2] += e;
+                next[x - 1] += e;
+                next[x] += e;
+                next[x + 1] += e;
+                next2[x] += e;
+            } else {
+                const int e7 = err * 7 / 16;
+                const int e3 = err * 3 / 16;
+                const int e5 = err * 5 / 16;
+                cur[x + 1] += e7;
+                next[x - 1] += e3;
+                next[x] += e5;
+                next[x + 1] += err - e7 - e3 - e5;
+            }
+        }
+
+        // Rotate: next becomes current, the one after becomes next.
+        std::rotate(rows_.begin(), rows_.begin() + 1, rows_.end());
+        std::fill(rows_[2].begin(), rows_[2].end(), 0);
+    }
+
+private:
+    MonoDither kind_;
+    size_t width_;
+    std::array<std::vector<int16_t>, 3> rows_;  // error for rows y, y+1, y+2
+};
+
+// Converts a `w` x `h` block of 8-bit gray to 1bpp at `dst` (MSB-first rows
+// of `dst_stride` bytes), e.g. straight into an Epd29 frame. The ordered
+// pattern is anchored at the block origin.
+inline void gray_to_mono(const uint8_t* gray, size_t gray_stride, uint8_t* dst, size_t dst_stride,
+                         size_t w, size_t h, MonoDither mode = MonoDither::THRESHOLD,
+                         uint8_t threshold = 128) {
+    if (mode == MonoDither::ATKINSON || mode == MonoDither::FLOYD_STEINBERG) {
+        MonoDiffuser diffuser(mode, w);
+        for (size_t y = 0; y < h; ++y, gray += gray_stride, dst += dst_stride) {
+            diffuser.convert_row(gray, dst);
+        }
+        return;
+    }
+
+    uint8_t flat[8];
+    std::fill(std::begin(flat), std::end(flat), threshold);
+    const PackRowFn pack = best_mono_kernel().pack;
+    for (size_t y = 0; y < h; ++y, gray += gray_stride, dst += dst_stride) {
+        pack(gray, dst, w, mode == MonoDither::ORDERED ? bayer8_row(y) : flat);
+    }
+}
+
+// 4-level gray, packed 2bpp MSB-first: 3 = white, 2 = light gray,
+// 1 = dark gray, 0 = black. The panel takes it as two 1bpp planes, the high
+// bits in the old-data RAM and the low bits in the new-data RAM, with a
+// waveform that maps each (old, new) pair to a level.
+namespace detail {
+
+// Gathers the even bits of a word (bit 0, 2, ..., 62) into its low 32 bits,
+// keeping their order.
+inline uint64_t compress_even_bits(uint64_t x) {
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return x;
+}
+
+inline void split_gray4_naive(const uint8_t* src, uint8_t* hi, uint8_t* lo, size_t n) {
+    std::memset(hi, 0, (n + 7) / 8);
+    std::memset(lo, 0, (n + 7) / 8);
+    for (size_t i = 0; i < n; ++i) {
+        const unsigned level = (src[i / 4] >> (6 - 2 * (i % 4))) & 3;
+        const uint8_t bit = 0x80 >> (i % 8);
+        if (level & 2) {
+            hi[i / 8] |= bit;
+        }
+        if (level & 1) {
+            lo[i / 8] |= bit;
+        }
+    }
+}
+
+}  // namespace detail
+
+// Splits `n` packed 2bpp pixels into the two 1bpp planes, 32 pixels per
+// 64-bit word: the high bits sit at odd positions and the low bits at even
+// ones, and each set is compressed with five shift/mask steps.
+inline void split_gray4(const uint8_t* src, uint8_t* hi, uint8_t* lo, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const uint64_t x = detail::load_be64(src + i / 4);
+        const uint32_t h = uint32_t(detail::compress_even_bits(x >> 1));
+        const uint32_t l = uint32_t(detail::compress_even_bits(x));
+        for (int b = 0; b < 4; ++b) {
+            hi[i / 8 + b] = uint8_t(h >> (24 - 8 * b));
+            lo[i / 8 + b] = uint8_t(l >> (24 - 8 * b));
+        }
+    }
+    if (i < n) {
+        detail::split_gray4_naive(src + i / 4, hi + i / 8, lo + i / 8, n - i);
+    }
+}
+
+// Quantises 8-bit gray to packed 2bpp with a 4x4 ordered dither between
+// adjacent levels.
+inline void gray_to_gray4(const uint8_t* gray, size_t gray_stride, uint8_t* dst, size_t dst_stride,
+                          size_t w, size_t h) {
+    static constexpr uint8_t BAYER[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+    for (size_t y = 0; y < h; ++y, gray += gray_stride, dst += dst_stride) {
+        std::memset(dst, 0, (w + 3) / 4);
+        for (size_t x = 0; x < w; ++x) {
+            // 255 / 3 = 85 per step; the bias spreads the remainder.
+            const unsigned scaled = gray[x] * 3 * 16 / 255 + BAYER[y & 3][x & 3];
+            const unsigned level = std::min(3u, scaled / 16);
+            dst[x / 4] |= level << (6 - 2 * (x % 4));
+        }
+    }
+}
+
+}  // namespace pidisp
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace pidisp {
+
+// Clockwise rotation of a 1bpp bitmap.
+enum class Rotation { R0, R90, R180, R270 };
+
+namespace detail {
+
+// An 8x8 block as one word: row 0 in the top byte, and each row MSB-first,
+// like the bitmap it came from.
+inline uint64_t gather8x8(const uint8_t* src, size_t stride) {
+    uint64_t x = 0;
+    for (int r = 0; r < 8; ++r) {
+        x = (x << 8) | src[r * stride];
+    }
+    return x;
+}
+
+inline void scatter8x8(uint64_t x, uint8_t* dst, size_t stride) {
+    for (int r = 7; r >= 0; --r) {
+        dst[r * stride] = uint8_t(x);
+        x >>= 8;
+    }
+}
+
+// Transpose in three delta swaps (Hacker's Delight 7-3): 2x2, 4x4, then 8x8.
+inline uint64_t transpose8x8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAull;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCull;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ull;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+// Mirrors every row (bit-reverses each byte).
+inline uint64_t flip_rows8x8(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ull) | ((x & 0x5555555555555555ull) << 1);
+    x = ((x >> 2) & 0x3333333333333333ull) | ((x & 0x3333333333333333ull) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((x & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return x;
+}
+
+// Reverses the row order.
+inline uint64_t flip_cols8x8(uint64_t x) {
+    return __builtin_bswap64(x);
+}
+
+inline bool mono_bit(const uint8_t* buf, size_t stride, size_t x, size_t y) {
+    return buf[y * stride + x / 8] & (0x80 >> (x % 8));
+}
+
+inline void set_mono_bit(uint8_t* buf, size_t stride, size_t x, size_t y, bool white) {
+    uint8_t& byte = buf[y * stride + x / 8];
+    const uint8_t bit = 0x80 >> (x % 8);
+    byte = white ? (byte | bit) : (byte & ~bit);
+}
+
+// Where pixel (x, y) of a w x h source lands in the rotated bitmap.
+inline void rotated_position(Rotation rot, size_t w, size_t h, size_t x, size_t y, size_t& dx,
+                             size_t& dy) {
+    switch (rot) {
+    case Rotation::R0:
+        dx = x;
+        dy = y;
+        break;
+    case Rotation::R90:
+        dx = h - 1 - y;
+        dy = x;
+        break;
+    case Rotation::R180:
+        dx = w - 1 - x;
+        dy = h - 1 - y;
+        break;
+    case Rotation::R270:
+        dx = y;
+        dy = w - 1 - x;
+        break;
+    }
+}
+
+inline void rotate_mono_naive(const uint8_t* src, size_t w, size_t h, size_t src_stride, uint8_t* dst,
+                              size_t dst_stride, Rotation rot) {
+    for (size_t y = 0; y < h; ++y) {
+        for (size_t x = 0; x < w; ++x) {
+            size_t dx = x;
+            size_t dy = y;
+            rotated_position(rot, w, h, x, y, dx, dy);
+            set_mono_bit(dst, dst_stride, dx, dy, mono_bit(src, src_stride, x, y));
+        }
+    }
+}
+
+}  // namespace detail
+
+// Rotates a w x h MSB-first 1bpp bitmap into `dst`, which is h x w for R90
+// and R270. When both sides are multiples of 8 the work is done on 8x8
+// blocks held in a 64-bit word: a bit-matrix transpose plus row and/or column
+// mirroring, so 64 pixels move per handful of shifts. Other sizes fall back
+// to a per-pixel loop.
+inline void rotate_mono(const uint8_t* src, size_t w, size_t h, size_t src_stride, uint8_t* dst,
+                        size_t dst_stride, Rotation rot) {
+    if (rot == Rotation::R0) {
+        for (size_t y = 0; y < h; ++y) {
+            std::memcpy(dst + y * dst_stride, src + y * src_stride, (w + 7) / 8);
+        }
+        return;
+    }
+    if (w % 8 || h % 8) {
+        detail::rotate_mono_naive(src, w, h, src_stride, dst, dst_stride, rot);
+        return;
+    }
+
+    const size_t bw = w / 8;
+    const size_t bh = h / 8;
+    for (size_t by = 0; by < bh; ++by) {
+        for (size_t bx = 0; bx < bw; ++bx) {
+            uint64_t block = detail::gather8x8(src + by * 8 * src_stride + bx, src_stride);
+            size_t dbx;
+            size_t dby;
+            switch (rot) {
+            case Rotation::R90:
+                block = detail::flip_rows8x8(detail::transpose8x8(block));
+                dbx = bh - 1 - by;
+                dby = bx;
+                break;
+            case Rotation::R180:
+                block = detail::flip_cols8x8(detail::flip_rows8x8(block));
+                dbx = bw - 1 - bx;
+                dby = bh - 1 - by;
+                break;
+            default:  // R270
+                block = detail::flip_cols8x8(detail::transpose8x8(block));
+                dbx = by;
+                dby = bw - 1 - bx;
+                break;
+            }
+            detail::scatter8x8(block, dst + dby * 8 * dst_stride + dbx, dst_stride);
+        }
+    }
+}
+
+}  // namespace pidisp
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+#include "spi_transfer.hpp"
+#include "task.hpp"
+
+// Runs the init tables from spi_transfer.hpp as tasks. Kept apart so the
+// transfer layer itself does not depend on the executor.
+namespace pidisp {
+
+struct InitReport {
+    size_t batches = 0;
+    size_t spi_syscalls = 0;
+    size_t gpio_ioctls = 0;
+    std::chrono::microseconds elapsed{};
+};
+
+// Replays an init table with as few submits as the table allows: commands are
+// queued into `txn` until a step needs a delay or a BUSY wait, at which point
+// the batch is flushed with `submit()` before waiting. `wait_busy(label)`
+// returns something to co_await and is only called for steps that ask for
+// it. Delays are delay() awaits, so under an Executor they free the thread.
+template <size_t N, typename Submit, typename WaitBusy>
+Task<InitReport> run_init(const std::array<InitStep, N>& steps, SpiTransaction& txn, const SpiStats& stats,
+                          Submit submit, WaitBusy wait_busy) {
+    const auto start = std::chrono::steady_clock::now();
+    const SpiStats before = stats;
+    InitReport report;
+
+    const auto flush = [&] {
+        if (!txn.empty()) {
+            submit();
+            ++report.batches;
+        }
+    };
+
+    for (const InitStep& step : steps) {
+        txn.command(step.cmd, step.args.data(), step.nargs);
+        if (step.delay_ms || step.wait_busy) {
+            flush();
+        }
+        if (step.wait_busy) {
+            co_await wait_busy(step.wait_busy);
+        }
+        if (step.delay_ms) {
+            co_await delay(std::chrono::milliseconds(step.delay_ms));
+        }
+    }
+    flush();
+
+    report.spi_syscalls = stats.spi_syscalls - before.spi_syscalls;
+    report.gpio_ioctls = stats.gpio_ioctls - before.gpio_ioctls;
+    report.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    co_return report;
+}
+
+}  // namespace pidisp
@@ -0,0 +1,133 @@
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "rgb565_convert.hpp"
+
+namespace {
+
+constexpr size_t WIDTH = 240;
+constexpr size_t HEIGHT = 240;
+constexpr int ITERATIONS = 2000;
+
+const char* format_name(pidisp::PixelFormat fmt) {
+    switch (fmt) {
+    case pidisp::PixelFormat::RGB888:
+        return "RGB888";
+    case pidisp::PixelFormat::RGBA8888:
+        return "RGBA8888";
+    case pidisp::PixelFormat::BGRA8888:
+        return "BGRA8888";
+    }
+    return "?";
+}
+
+}  // namespace
+
+int main() {
+    std::mt19937 rng(42);
+    std::vector<uint8_t> src(WIDTH * HEIGHT * 4);
+    for (auto& byte : src) {
+        byte = rng();
+    }
+
+    std::vector<uint8_t> reference(WIDTH * HEIGHT * 2);
+    std::vector<uint8_t> dst(WIDTH * HEIGHT * 2);
+
+    const auto kernels = pidisp::rgb565_kernels();
+    std::cout << "240x240 frame, " << ITERATIONS << " iterations per kernel\n";
+
+    for (auto fmt : {pidisp::PixelFormat::RGB888, pidisp::PixelFormat::RGBA8888,
+                     pidisp::PixelFormat::BGRA8888}) {
+        const size_t src_bytes = WIDTH * HEIGHT * pidisp::bytes_per_pixel(fmt);
+        kernels.front().for_format(fmt)(src.data(), reference.data(), WIDTH * HEIGHT);
+
+        double scalar_us = 0;
+        for (const auto& kernel : kernels) {
+            const auto convert = kernel.for_format(fmt);
+
+            // Odd lengths exercise the scalar tails of the vector kernels.
+            convert(src.data(), dst.data(), WIDTH * HEIGHT - 7);
+            const bool ok = std::memcmp(dst.data(), reference.data(), (WIDTH * HEIGHT - 7) * 2) == 0;
+
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < ITERATIONS; ++i) {
+                convert(src.data(), dst.data(), WIDTH * HEIGHT);
+                asm volatile("" : : "r"(dst.data()) : "memory");
+            }
+            const double us = std::chrono::duration<double, std::micro>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count() /
+                              ITERATIONS;
+            if (!scalar_us) {
+                scalar_us = us;
+            }
+
+            std::cout << std::left << std::setw(10) << format_name(fmt) << std::setw(8) << kernel.name
+                      << std::right << std::fixed << std::setprecision(1) << std::setw(8) << us
+                      << " us/frame " << std::setw(8) << src_bytes / us << " MB/s  x"
+                      << std::setprecision(2) << scalar_us / us << (ok ? "" : "  MISMATCH") << "\n";
+        }
+    }
+
+    // Dithering cost on top of the conversion, RGB888 source.
+    std::cout << "\nDithering, RGB888 240x240\n";
+    const size_t stride = WIDTH * 3;
+    const auto time_frames = [&](const char* name, auto&& body) {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < ITERATIONS / 10; ++i) {
+            body();
+            asm volatile("" : : "r"(dst.data()) : "memory");
+        }
+        const double us =
+            std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() /
+            (ITERATIONS / 10);
+        std::cout << std::left << std::setw(20) << name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(8) << us << " us/frame\n";
+    };
+
+    for (auto dither : {pidisp::Dither::NONE, pidisp::Dither::ORDERED, pidisp::Dither::FLOYD_STEINBERG}) {
+        const char* name = dither == pidisp::Dither::NONE      ? "none"
+                           : dither == pidisp::Dither::ORDERED ? "ordered"
+                                                               : "floyd-steinberg";
+        time_frames(name, [&] {
+            pidisp::convert_to_rgb565(src.data(), stride, pidisp::PixelFormat::RGB888, dst.data(),
+                                      WIDTH * 2, WIDTH, HEIGHT, dither, 0, 0);
+        });
+    }
+
+    // Rendering a frame row by row, serially versus overlapped with a
+    // Floyd-Steinberg worker that dithers each row as soon as it is published.
+    std::vector<uint8_t> canvas(WIDTH * HEIGHT * 3);
+    const auto render_row = [&](size_t y) {
+        for (size_t x = 0; x < stride; ++x) {
+            canvas[y * stride + x] = uint8_t(src[y * stride + x] * 3 + x + y);
+        }
+    };
+    time_frames("render + fs serial", [&] {
+        for (size_t y = 0; y < HEIGHT; ++y) {
+            render_row(y);
+        }
+        pidisp::convert_to_rgb565(canvas.data(), stride, pidisp::PixelFormat::RGB888, dst.data(),
+                                  WIDTH * 2, WIDTH, HEIGHT, pidisp::Dither::FLOYD_STEINBERG, 0, 0);
+    });
+    pidisp::DitherWorker worker;
+    time_frames("render + fs worker", [&] {
+        worker.begin(canvas.data(), stride, pidisp::PixelFormat::RGB888, dst.data(), WIDTH * 2, WIDTH,
+                     HEIGHT);
+        for (size_t y = 0; y < HEIGHT; ++y) {
+            render_row(y);
+            if (y % 16 == 15) {
+                worker.publish_rows(y + 1);
+            }
+        }
+        worker.publish_rows(HEIGHT);
+        worker.finish();
+    });
+
+    return 0;
+}
@@ -0,0 +1,521 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIDISP_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define PIDISP_NEON 1
+#endif
+
+namespace pidisp {
+
+// Source layouts accepted by the RGB565 converters, named in memory byte order.
+enum class PixelFormat { RGB888, RGBA8888, BGRA8888 };
+
+constexpr size_t bytes_per_pixel(PixelFormat fmt) {
+    return fmt == PixelFormat::RGB888 ? 3 : 4;
+}
+
+// Byte offsets of the red and blue channels within one source pixel.
+constexpr size_t red_offset(PixelFormat fmt) {
+    return fmt == PixelFormat::BGRA8888 ? 2 : 0;
+}
+
+constexpr size_t blue_offset(PixelFormat fmt) {
+    return fmt == PixelFormat::BGRA8888 ? 0 : 2;
+}
+
+enum class Dither { NONE, ORDERED, FLOYD_STEINBERG };
+
+// Converts `n` pixels to RGB565 in panel byte order (high byte first), which
+// is what the GC9A01 expects after COLMOD 0x55.
+using ConvertRowFn = void (*)(const uint8_t* src, uint8_t* dst, size_t n);
+
+struct Rgb565Kernel {
+    const char* name;
+    ConvertRowFn rgb888;
+    ConvertRowFn rgba8888;
+    ConvertRowFn bgra8888;
+
+    ConvertRowFn for_format(PixelFormat fmt) const {
+        switch (fmt) {
+        case PixelFormat::RGB888:
+            return rgb888;
+        case PixelFormat::RGBA8888:
+            return rgba8888;
+        case PixelFormat::BGRA8888:
+            return bgra8888;
+        }
+        return rgb888;
+    }
+};
+
+namespace detail {
+
+inline void store_rgb565(uint8_t* dst, uint8_t r, uint8_t g, uint8_t b) {
+    dst[0] = (r & 0xF8) | (g >> 5);
+    dst[1] = ((g << 3) & 0xE0) | (b >> 3);
+}
+
+template <size_t BPP, size_t R, size_t G, size_t B>
+void convert_scalar(const uint8_t* src, uint8_t* dst, size_t n) {
+    for (size_t i = 0; i < n; ++i, src += BPP, dst += 2) {
+        store_rgb565(dst, src[R], src[G], src[B]);
+    }
+}
+
+#ifdef PIDISP_X86
+
+// Each 32-bit lane holds one pixel as R | G << 8 | B << 16 (RGBA order) or
+// B | G << 8 | R << 16 (BGRA order). The result is the byte-swapped RGB565
+// value in the low 16 bits, so a little-endian store yields panel order:
+//   low byte  = (R & 0xF8) | G >> 5
+//   high byte = (G << 3 & 0xE0) | B >> 3
+template <bool BGR>
+__attribute__((target("sse2"))) inline __m128i swap565_sse(__m128i p) {
+    const __m128i r = BGR ? _mm_and_si128(_mm_srli_epi32(p, 16), _mm_set1_epi32(0xF8))
+                          : _mm_and_si128(p, _mm_set1_epi32(0xF8));
+    const __m128i b = BGR ? _mm_and_si128(_mm_slli_epi32(p, 5), _mm_set1_epi32(0x1F00))
+                          : _mm_and_si128(_mm_srli_epi32(p, 11), _mm_set1_epi32(0x1F00));
+    const __m128i g_hi = _mm_and_si128(_mm_srli_epi32(p, 13), _mm_set1_epi32(0x07));
+    const __m128i g_lo = _mm_and_si128(_mm_slli_epi32(p, 3), _mm_set1_epi32(0xE000));
+    const __m128i v = _mm_or_si128(_mm_or_si128(r, b), _mm_or_si128(g_hi, g_lo));
+    // Sign-extend so the signed saturating pack keeps all 16 bits.
+    return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+template <bool BGR>
+__attribute__((target("sse2"))) void convert32_sse2(const uint8_t* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4 + 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2),
+                         _mm_packs_epi32(swap565_sse<BGR>(a), swap565_sse<BGR>(b)));
+    }
+    if (BGR) {
+        convert_scalar<4, 2, 1, 0>(src + i * 4, dst + i * 2, n - i);
+    } else {
+        convert_scalar<4, 0, 1, 2>(src + i * 4, dst + i * 2, n - i);
+    }
+}
+
+__attribute__((target("ssse3"))) inline void convert24_ssse3(const uint8_t* src, uint8_t* dst,
+                                                             size_t n) {
+    // Spread 4 packed RGB triplets into 4 RGBx lanes.
+    const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    size_t i = 0;
+    // Two 16-byte loads at 3i and 3i+12 read up to byte 3i+28.
+    for (; i + 10 <= n; i += 8) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 12));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 2),
+                         _mm_packs_epi32(swap565_sse<false>(_mm_shuffle_epi8(a, spread)),
+                                         swap565_sse<false>(_mm_shuffle_epi8(b, spread))));
+    }
+    convert_scalar<3, 0, 1, 2>(src + i * 3, dst + i * 2, n - i);
+}
+
+template <bool BGR>
+__attribute__((target("avx2"))) inline __m256i swap565_avx2(__m256i p) {
+    const __m256i r = BGR ? _mm256_and_si256(_mm256_srli_epi32(p, 16), _mm256_set1_epi32(0xF8))
+                          : _mm256_and_si256(p, _mm256_set1_epi32(0xF8));
+    const __m256i b = BGR ? _mm256_and_si256(_mm256_slli_epi32(p, 5), _mm256_set1_epi32(0x1F00))
+                          : _mm256_and_si256(_mm256_srli_epi32(p, 11), _mm256_set1_epi32(0x1F00));
+    const __m256i g_hi = _mm256_and_si256(_mm256_srli_epi32(p, 13), _mm256_set1_epi32(0x07));
+    const __m256i g_lo = _mm256_and_si256(_mm256_slli_epi32(p, 3), _mm256_set1_epi32(0xE000));
+    const __m256i v = _mm256_or_si256(_mm256_or_si256(r, b), _mm256_or_si256(g_hi, g_lo));
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+// _mm256_packs_epi32 packs within 128-bit lanes; restore linear pixel order.
+__attribute__((target("avx2"))) inline __m256i pack565_avx2(__m256i a, __m256i b) {
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+}
+
+template <bool BGR>
+__attribute__((target("avx2"))) void convert32_avx2(const uint8_t* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4 + 32));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2),
+                            pack565_avx2(swap565_avx2<BGR>(a), swap565_avx2<BGR>(b)));
+    }
+    convert32_sse2<BGR>(src + i * 4, dst + i * 2, n - i);
+}
+
+__attribute__((target("avx2"))) inline __m256i load_rgb8x8_avx2(const uint8_t* src) {
+    const __m256i spread = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 12));
+    return _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), spread);
+}
+
+__attribute__((target("avx2"))) void convert24_avx2(const uint8_t* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    // The second 8-pixel group reads up to byte 3i+52.
+    for (; i + 18 <= n; i += 16) {
+        const __m256i a = load_rgb8x8_avx2(src + i * 3);
+        const __m256i b = load_rgb8x8_avx2(src + i * 3 + 24);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 2),
+                            pack565_avx2(swap565_avx2<false>(a), swap565_avx2<false>(b)));
+    }
+    convert24_ssse3(src + i * 3, dst + i * 2, n - i);
+}
+
+#endif  // PIDISP_X86
+
+#ifdef PIDISP_NEON
+
+inline void store565_neon(uint8_t* dst, uint8x16_t r, uint8x16_t g, uint8x16_t b) {
+    uint8x16x2_t out;
+    out.val[0] = vorrq_u8(vandq_u8(r, vdupq_n_u8(0xF8)), vshrq_n_u8(g, 5));
+    out.val[1] = vorrq_u8(vandq_u8(vshlq_n_u8(g, 3), vdupq_n_u8(0xE0)), vshrq_n_u8(b, 3));
+    vst2q_u8(dst, out);  // interleaves high/low bytes: panel order
+}
+
+inline void convert24_neon(const uint8_t* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16x3_t px = vld3q_u8(src + i * 3);
+        store565_neon(dst + i * 2, px.val[0], px.val[1], px.val[2]);
+    }
+    convert_scalar<3, 0, 1, 2>(src + i * 3, dst + i * 2, n - i);
+}
+
+template <bool BGR>
+void convert32_neon(const uint8_t* src, uint8_t* dst, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const uint8x16x4_t px = vld4q_u8(src + i * 4);
+        store565_neon(dst + i * 2, px.val[BGR ? 2 : 0], px.val[1], px.val[BGR ? 0 : 2]);
+    }
+    if (BGR) {
+        convert_scalar<4, 2, 1, 0>(src + i * 4, dst + i * 2, n - i);
+    } else {
+        convert_scalar<4, 0, 1, 2>(src + i * 4, dst + i * 2, n - i);
+    }
+}
+
+#endif  // PIDISP_NEON
+
+}  // namespace detail
+
+// Every kernel this CPU can run, slowest first; the scalar loop is always there.
+inline std::vector<Rgb565Kernel> rgb565_kernels() {
+    std::vector<Rgb565Kernel> kernels{{"scalar", detail::convert_scalar<3, 0, 1, 2>,
+                                       detail::convert_scalar<4, 0, 1, 2>,
+                                       detail::convert_scalar<4, 2, 1, 0>}};
+#ifdef PIDISP_X86
+    if (__builtin_cpu_supports("ssse3")) {
+        kernels.push_back({"ssse3", detail::convert24_ssse3, detail::convert32_sse2<false>,
+                           detail::convert32_sse2<true>});
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.push_back({"avx2", detail::convert24_avx2, detail::convert32_avx2<false>,
+                           detail::convert32_avx2<true>});
+    }
+#endif
+#ifdef PIDISP_NEON
+    kernels.push_back({"neon", detail::convert24_neon, detail::convert32_neon<false>,
+                       detail::convert32_neon<true>});
+#endif
+    return kernels;
+}
+
+inline const Rgb565Kernel& best_rgb565_kernel() {
+    static const Rgb565Kernel best = rgb565_kernels().back();
+    return best;
+}
+
+// Converts a `w` x `h` block with arbitrary source and destination strides.
+inline void convert_to_rgb565(const uint8_t* src, size_t src_stride, PixelFormat fmt, uint8_t* dst,
+                              size_t dst_stride, size_t w, size_t h) {
+    const ConvertRowFn row = best_rgb565_kernel().for_format(fmt);
+    for (size_t y = 0; y < h; ++y, src += src_stride, dst += dst_stride) {
+        row(src, dst, w);
+    }
+}
+
+namespace detail {
+
+// out[i] = min(a[i] + b[i], 255)
+inline void add_saturate_u8(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t n) {
+    size_t i = 0;
+#if defined(PIDISP_NEON)
+    for (; i + 16 <= n; i += 16) {
+        vst1q_u8(out + i, vqaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+#elif defined(__SSE2__)
+    for (; i + 16 <= n; i += 16) {
+        const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_adds_epu8(va, vb));
+    }
+#endif
+    for (; i < n; ++i) {
+        out[i] = std::min(a[i] + b[i], 255);
+    }
+}
+
+}  // namespace detail
+
+// 4x4 Bayer ordered dither. Each channel gets a position-dependent bias of up
+// to one RGB565 quantisation step (8 for red/blue, 4 for green) before the
+// truncating conversion, so the work is one saturating SIMD add per row on
+// top of the plain kernel. The pattern is anchored to panel coordinates, so
+// partial updates line up with what is already on screen.
+class OrderedDither {
+public:
+    OrderedDither(PixelFormat fmt, size_t max_width)
+        : fmt_(fmt), bpp_(bytes_per_pixel(fmt)), scratch_(max_width * bpp_) {
+        static constexpr uint8_t BAYER[4][4] = {
+            {0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+        for (size_t y = 0; y < 4; ++y) {
+            // Three extra pixels so any x0 & 3 can start the pattern.
+            bias_[y].assign((max_width + 3) * bpp_, 0);
+            for (size_t x = 0; x < max_width + 3; ++x) {
+                const unsigned m = 2 * BAYER[y][x & 3] + 1;  // (m + 0.5) / 16 in 32nds
+                uint8_t* px = &bias_[y][x * bpp_];
+                px[red_offset(fmt)] = m * 8 / 32;
+                px[1] = m * 4 / 32;
+                px[blue_offset(fmt)] = m * 8 / 32;
+            }
+        }
+    }
+
+    // Converts `n` pixels whose first pixel sits at panel column x0, row y.
+    void convert_row(const uint8_t* src, uint8_t* dst, size_t n, size_t x0, size_t y) {
+        detail::add_saturate_u8(src, &bias_[y & 3][(x0 & 3) * bpp_], scratch_.data(), n * bpp_);
+        best_rgb565_kernel().for_format(fmt_)(scratch_.data(), dst, n);
+    }
+
+private:
+    PixelFormat fmt_;
+    size_t bpp_;
+    std::vector<uint8_t> bias_[4];
+    std::vector<uint8_t> scratch_;
+};
+
+// Floyd-Steinberg error diffusion. Rows must be fed top to bottom; only the
+// error for the current and next row is kept, so a frame can be dithered as
+// its rows are produced (see DitherWorker).
+class FloydSteinberg {
+public:
+    FloydSteinberg(PixelFormat fmt, size_t width)
+        : fmt_(fmt), width_(width), cur_((width + 2) * 3), next_((width + 2) * 3) {}
+
+    void reset() {
+        std::fill(cur_.begin(), cur_.end(), 0);
+        std::fill(next_.begin(), next_.end(), 0);
+    }
+
+    void convert_row(const uint8_t* src, uint8_t* dst) {
+        const size_t bpp = bytes_per_pixel(fmt_);
+        const size_t ro = red_offset(fmt_);
+        const size_t bo = blue_offset(fmt_);
+        const auto& lut = tables();
+
+        // Error arrays carry one guard pixel on each side. The error headed
+        // right and the two pending below-row sums stay in registers; next[]
+        // is written once per pixel, after its last contribution.
+        const int16_t* cur = cur_.data() + 3;
+        int16_t* next = next_.data() + 3;
+        int right[3] = {0, 0, 0};
+        int below_left[3] = {0, 0, 0};
+        int below[3] = {0, 0, 0};
+        for (size_t x = 0; x < width_; ++x, src += bpp, dst += 2) {
+            const uint8_t in[3] = {src[ro], src[1], src[bo]};
+            uint8_t q[3];
+            for (int c = 0; c < 3; ++c) {
+                const int acc = cur[x * 3 + c] + right[c];
+                const uint8_t want = lut.clamp[in[c] + ((acc + 8) >> 4) + 256];
+                q[c] = c == 1 ? lut.q6[want] : lut.q5[want];
+                const int err = want - (c == 1 ? lut.shown6[q[c]] : lut.shown5[q[c]]);
+
+                right[c] = err * 7;
+                next[(int(x) - 1) * 3 + c] = below_left[c] + err * 3;
+                below_left[c] = below[c] + err * 5;
+                below[c] = err;
+            }
+            dst[0] = (q[0] << 3) | (q[1] >> 3);
+            dst[1] = ((q[1] & 0x07) << 5) | q[2];
+        }
+        for (int c = 0; c < 3; ++c) {
+            next[(width_ - 1) * 3 + c] = below_left[c];
+        }
+
+        cur_.swap(next_);
+    }
+
+private:
+    // Nearest 5/6-bit level for each 8-bit value, the 8-bit value the panel
+    // shows for each level, and a clamp for input plus accumulated error.
+    struct Tables {
+        uint8_t q5[256], q6[256], shown5[32], shown6[64];
+        uint8_t clamp[768];
+    };
+
+    static const Tables& tables() {
+        static const Tables t = [] {
+            Tables t{};
+            for (int v = 0; v < 256; ++v) {
+                t.q5[v] = (v * 31 + 127) / 255;
+                t.q6[v] = (v * 63 + 127) / 255;
+            }
+            for (int q = 0; q < 32; ++q) {
+                t.shown5[q] = (q << 3) | (q >> 2);
+            }
+            for (int q = 0; q < 64; ++q) {
+                t.shown6[q] = (q << 2) | (q >> 4);
+            }
+            for (int i = 0; i < 768; ++i) {
+                t.clamp[i] = std::clamp(i - 256, 0, 255);
+            }
+            return t;
+        }();
+        return t;
+    }
+
+    PixelFormat fmt_;
+    size_t width_;
+    std::vector<int16_t> cur_;  // error in 1/16 units
+    std::vector<int16_t> next_;
+};
+
+// Runs Floyd-Steinberg on its own thread, row-pipelined: the producer
+// publishes rows as it finishes rendering them and a consumer (e.g. the SPI
+// flush) can start on the first dithered rows before the frame is complete.
+class DitherWorker {
+public:
+    DitherWorker() : thread_([this] { run(); }) {}
+
+    ~DitherWorker() {
+        stop_.store(true);
+        frame_.fetch_add(1);
+        frame_.notify_one();
+        ready_.fetch_add(1);
+        ready_.notify_one();
+        thread_.join();
+    }
+
+    DitherWorker(const DitherWorker&) = delete;
+    DitherWorker& operator=(const DitherWorker&) = delete;
+
+    // Starts a frame. Waits for the previous one, whose buffers may be reused.
+    void begin(const uint8_t* src, size_t src_stride, PixelFormat fmt, uint8_t* dst,
+               size_t dst_stride, size_t width, size_t height) {
+        wait_rows(height_);
+        job_ = {src, src_stride, fmt, dst, dst_stride, width, height};
+        height_ = height;
+        done_.store(0);
+        ready_.store(0, std::memory_order_release);
+        frame_.fetch_add(1, std::memory_order_release);
+        frame_.notify_one();
+    }
+
+    // Producer side: rows [0, rows) of the source are final.
+    void publish_rows(size_t rows) {
+        ready_.store(rows, std::memory_order_release);
+        ready_.notify_one();
+    }
+
+    // Consumer side: block until rows [0, rows) of the output are written.
+    void wait_rows(size_t rows) {
+        for (size_t done = done_.load(std::memory_order_acquire); done < rows;
+             done = done_.load(std::memory_order_acquire)) {
+            done_.wait(done);
+        }
+    }
+
+    void finish() { wait_rows(height_); }
+
+private:
+    struct Job {
+        const uint8_t* src;
+        size_t src_stride;
+        PixelFormat fmt;
+        uint8_t* dst;
+        size_t dst_stride;
+        size_t width;
+        size_t height;
+    };
+
+    void run() {
+        uint32_t seen_frame = 0;
+        for (;;) {
+            frame_.wait(seen_frame);
+            if (stop_.load()) {
+                return;
+            }
+            seen_frame = frame_.load(std::memory_order_acquire);
+
+            const Job job = job_;
+            FloydSteinberg fs(job.fmt, job.width);
+            for (size_t row = 0; row < job.height;) {
+                const size_t ready = ready_.load(std::memory_order_acquire);
+                if (stop_.load()) {
+                    return;
+                }
+                if (row >= ready) {
+                    ready_.wait(ready);
+                    continue;
+                }
+                for (; row < ready && row < job.height; ++row) {
+                    fs.convert_row(job.src + row * job.src_stride, job.dst + row * job.dst_stride);
+                }
+                done_.store(row, std::memory_order_release);
+                done_.notify_all();
+            }
+        }
+    }
+
+    Job job_{};
+    size_t height_ = 0;
+    std::atomic<uint32_t> frame_{0};
+    std::atomic<size_t> ready_{0};
+    std::atomic<size_t> done_{0};
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+};
+
+// Converts a block with optional dithering. (x0, y0) is the block's position
+// on the panel, which anchors the ordered pattern.
+inline void convert_to_rgb565(const uint8_t* src, size_t src_stride, PixelFormat fmt, uint8_t* dst,
+                              size_t dst_stride, size_t w, size_t h, Dither dither, size_t x0,
+                              size_t y0) {
+    switch (dither) {
+    case Dither::NONE:
+        convert_to_rgb565(src, src_stride, fmt, dst, dst_stride, w, h);
+        return;
+    case Dither::ORDERED: {
+        OrderedDither od(fmt, w);
+        for (size_t y = 0; y < h; ++y, src += src_stride, dst += dst_stride) {
+            od.convert_row(src, dst, w, x0, y0 + y);
+        }
+        return;
+    }
+    case Dither::FLOYD_STEINBERG: {
+        FloydSteinberg fs(fmt, w);
+        for (size_t y = 0; y < h; ++y, src += src_stride, dst += dst_stride) {
+            fs.convert_row(src, dst);
+        }
+        return;
+    }
+    }
+}
+
+}  // namespace pidisp
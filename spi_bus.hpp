@@ -0,0 +1,305 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/spi/spidev.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+namespace pidisp {
+
+// How a client wants its spidev device clocked. Only `mode` is device state;
+// the driver stamps speed and word size into each transfer (see
+// TransferPlanner::set_clock), so they never cost an ioctl.
+struct SpiDeviceConfig {
+    std::string path;  // e.g. "/dev/spidev0.0"
+    uint8_t mode;
+    uint32_t speed_hz;
+    uint8_t bits = 8;
+};
+
+// Bus time as seen by one client, cumulative since attach().
+struct BusClientStats {
+    size_t grants = 0;
+    size_t contended = 0;  // grants that had to queue behind another client
+    size_t yields = 0;     // times the client handed the bus over mid-operation
+    std::chrono::microseconds wait_total{};
+    std::chrono::microseconds wait_max{};
+    std::chrono::microseconds hold_total{};
+};
+
+// Arbitrates one SPI controller between several panel drivers, each usually
+// on its own thread. A driver holds the bus only while it is clocking bytes:
+// it takes a lease around each submit and drops it for BUSY waits and
+// controller delays, so one panel's refresh never stalls another's traffic.
+//
+// Waiting clients are served earliest-deadline-first. A request falls due
+// the client's relative deadline after it was made, so an animated panel
+// with a deadline of about one frame goes ahead of an e-paper panel with a
+// long one, and the e-paper panel still gets the bus once its request ages.
+// Long uploads call Lease::yield() between chunks so a waiting client can cut
+// in without the uploader giving up its place for good.
+//
+// Clients are attached before the driver threads start. The bus owns the
+// spidev file descriptors; clients on the same device share one. The bus
+// caches each device's mode and only issues SPI_IOC_WR_MODE when the next
+// owner of a shared device wants a different one. Panels on their own chip
+// selects therefore switch with no syscalls at all.
+class SpiBus {
+    struct Device {
+        std::string path;
+        int fd;
+        uint8_t mode;  // as last read from or written to the kernel
+    };
+
+public:
+    class Client;
+
+    // Ownership of the bus, released on destruction. Leases nest per client:
+    // acquiring again while already holding the bus only bumps a depth count.
+    class Lease {
+    public:
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease(Lease&& other) noexcept : client_(std::exchange(other.client_, nullptr)) {}
+        ~Lease() { release(); }
+
+        void release();
+
+        // Hands the bus to a waiting client, if there is one, and queues to
+        // get it back. Only the outermost lease can yield.
+        void yield();
+
+    private:
+        friend class Client;
+        explicit Lease(Client* client) : client_(client) {}
+
+        Client* client_;
+    };
+
+    class Client {
+    public:
+        const std::string& name() const { return name_; }
+        const SpiDeviceConfig& config() const { return config_; }
+        std::chrono::microseconds deadline() const { return deadline_; }
+
+        // Only meaningful while holding a lease.
+        int fd() const { return device_->fd; }
+
+        // Blocks until the bus is granted to this client.
+        Lease acquire() {
+            bus_.acquire(*this);
+            return Lease(this);
+        }
+
+        BusClientStats stats() const {
+            std::lock_guard lock(bus_.mutex_);
+            return stats_;
+        }
+
+    private:
+        friend class SpiBus;
+
+        Client(SpiBus& bus, std::string name, SpiDeviceConfig config, Device* device,
+               std::chrono::microseconds deadline)
+            : bus_(bus), name_(std::move(name)), config_(std::move(config)), device_(device),
+              deadline_(deadline) {}
+
+        SpiBus& bus_;
+        std::string name_;
+        SpiDeviceConfig config_;
+        Device* device_;
+        std::chrono::microseconds deadline_;
+
+        // Guarded by the bus mutex.
+        int depth_ = 0;
+        std::chrono::steady_clock::time_point granted_at_;
+        BusClientStats stats_;
+    };
+
+    SpiBus() = default;
+    SpiBus(const SpiBus&) = delete;
+    SpiBus& operator=(const SpiBus&) = delete;
+
+    ~SpiBus() {
+        for (const auto& device : devices_) {
+            close(device->fd);
+        }
+    }
+
+    // Registers a driver. `deadline` is how long its requests may wait before
+    // they are due; shorter deadlines win the bus first.
+    Client& attach(std::string name, SpiDeviceConfig config, std::chrono::microseconds deadline) {
+        std::lock_guard lock(mutex_);
+        Device* device = nullptr;
+        for (const auto& d : devices_) {
+            if (d->path == config.path) {
+                device = d.get();
+            }
+        }
+        if (!device) {
+            const int fd = ::open(config.path.c_str(), O_RDWR);
+            if (fd < 0) {
+                throw std::runtime_error("failed to open " + config.path + ": " + std::strerror(errno));
+            }
+            uint8_t mode = 0;
+            if (ioctl(fd, SPI_IOC_RD_MODE, &mode) < 0) {
+                close(fd);
+                throw std::runtime_error("failed to read mode of " + config.path);
+            }
+            devices_.push_back(std::make_unique<Device>(Device{config.path, fd, mode}));
+            device = devices_.back().get();
+        }
+        if (!configure(*device, config)) {
+            throw std::runtime_error("failed to configure " + config.path);
+        }
+
+        clients_.push_back(std::unique_ptr<Client>(
+            new Client(*this, std::move(name), std::move(config), device, deadline)));
+        return *clients_.back();
+    }
+
+    std::vector<const Client*> clients() const {
+        std::lock_guard lock(mutex_);
+        std::vector<const Client*> out;
+        for (const auto& c : clients_) {
+            out.push_back(c.get());
+        }
+        return out;
+    }
+
+    // SPI_IOC_WR_MODE calls issued, at attach() or because consecutive owners
+    // of a shared device wanted different modes.
+    size_t config_ioctls() const {
+        std::lock_guard lock(mutex_);
+        return config_ioctls_;
+    }
+
+private:
+    struct Waiter {
+        Client* client;
+        std::chrono::steady_clock::time_point due;
+        uint64_t seq;  // FIFO among equal deadlines
+    };
+
+    // Switches the device to the client's mode if it is not already there.
+    // Called with the mutex held.
+    bool configure(Device& device, const SpiDeviceConfig& config) {
+        if (device.mode == config.mode) {
+            return true;
+        }
+        ++config_ioctls_;
+        if (ioctl(device.fd, SPI_IOC_WR_MODE, &config.mode) < 0) {
+            return false;
+        }
+        device.mode = config.mode;
+        return true;
+    }
+
+    const Client* next_waiter() const {
+        const auto it =
+            std::min_element(waiters_.begin(), waiters_.end(), [](const Waiter& a, const Waiter& b) {
+                return a.due != b.due ? a.due < b.due : a.seq < b.seq;
+            });
+        return it == waiters_.end() ? nullptr : it->client;
+    }
+
+    void acquire(Client& client) {
+        std::unique_lock lock(mutex_);
+        if (owner_ == &client) {
+            ++client.depth_;
+            return;
+        }
+        grant(client, lock);
+    }
+
+    // Queues `client` (unless the bus is idle with nobody waiting) and makes
+    // it the owner.
+    void grant(Client& client, std::unique_lock<std::mutex>& lock) {
+        const auto asked = std::chrono::steady_clock::now();
+        if (owner_ || !waiters_.empty()) {
+            waiters_.push_back({&client, asked + client.deadline_, seq_++});
+            cv_.wait(lock, [&] { return !owner_ && next_waiter() == &client; });
+            waiters_.erase(std::find_if(waiters_.begin(), waiters_.end(),
+                                        [&](const Waiter& w) { return w.client == &client; }));
+            ++client.stats_.contended;
+        }
+
+        owner_ = &client;
+        client.depth_ = 1;
+        client.granted_at_ = std::chrono::steady_clock::now();
+        const auto waited =
+            std::chrono::duration_cast<std::chrono::microseconds>(client.granted_at_ - asked);
+        ++client.stats_.grants;
+        client.stats_.wait_total += waited;
+        client.stats_.wait_max = std::max(client.stats_.wait_max, waited);
+
+        if (!configure(*client.device_, client.config_)) {
+            owner_ = nullptr;
+            client.depth_ = 0;
+            cv_.notify_all();
+            throw std::runtime_error("failed to configure " + client.config_.path + ": " +
+                                     std::strerror(errno));
+        }
+    }
+
+    void release(Client& client) {
+        std::lock_guard lock(mutex_);
+        if (--client.depth_ == 0) {
+            drop(client);
+        }
+    }
+
+    void drop(Client& client) {
+        client.stats_.hold_total += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - client.granted_at_);
+        owner_ = nullptr;
+        cv_.notify_all();
+    }
+
+    void yield(Client& client) {
+        std::unique_lock lock(mutex_);
+        if (client.depth_ != 1 || waiters_.empty()) {
+            return;
+        }
+        ++client.stats_.yields;
+        drop(client);
+        grant(client, lock);
+    }
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::unique_ptr<Device>> devices_;
+    std::vector<std::unique_ptr<Client>> clients_;
+    std::vector<Waiter> waiters_;
+    Client* owner_ = nullptr;
+    uint64_t seq_ = 0;
+    size_t config_ioctls_ = 0;
+};
+
+inline void SpiBus::Lease::release() {
+    if (client_) {
+        client_->bus_.release(*client_);
+        client_ = nullptr;
+    }
+}
+
+inline void SpiBus::Lease::yield() {
+    if (client_) {
+        client_->bus_.yield(*client_);
+    }
+}
+
+}  // namespace pidisp
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <initializer_list>
+#include <linux/spi/spidev.h>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <utility>
+#include <vector>
+
+namespace pidisp {
+
+// Syscall accounting for a driver, so batching wins are visible from main().
+// The SPI side is filled in here; GPIO ioctls are counted by the driver's own
+// line setters.
+struct SpiStats {
+    size_t spi_syscalls = 0;
+    size_t gpio_ioctls = 0;
+    size_t bytes = 0;
+    size_t short_transfers = 0;
+};
+
+// Sends `xfers` as one SPI_IOC_MESSAGE. If the controller reports fewer bytes
+// than requested, the completed transfers are dropped, the partial one is
+// trimmed, and the remainder is resubmitted.
+inline void send_message(int fd, std::vector<spi_ioc_transfer>& xfers, SpiStats& stats) {
+    size_t first = 0;
+    while (first < xfers.size()) {
+        size_t want = 0;
+        for (size_t i = first; i < xfers.size(); ++i) {
+            want += xfers[i].len;
+        }
+
+        const int done = ioctl(fd, SPI_IOC_MESSAGE(xfers.size() - first), xfers.data() + first);
+        ++stats.spi_syscalls;
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("SPI_IOC_MESSAGE failed: " + std::string(std::strerror(errno)));
+        }
+        if (done == 0 && want) {
+            throw std::runtime_error("SPI_IOC_MESSAGE transferred nothing");
+        }
+        stats.bytes += done;
+        if (size_t(done) >= want) {
+            return;
+        }
+
+        ++stats.short_transfers;
+        size_t left = done;
+        while (left >= xfers[first].len) {
+            left -= xfers[first].len;
+            ++first;
+        }
+        xfers[first].tx_buf += left;
+        xfers[first].len -= left;
+    }
+}
+
+// Decides how payloads are cut into spidev messages. spidev rejects any
+// message whose total length exceeds its `bufsiz` module parameter, so that
+// is read once at startup and every message is packed up to it.
+class TransferPlanner {
+public:
+    static constexpr size_t DEFAULT_BUFSIZ = 4096;  // spidev's compiled-in default
+
+    static size_t read_bufsiz(const char* path = "/sys/module/spidev/parameters/bufsiz") {
+        std::ifstream in(path);
+        size_t value = 0;
+        if (in >> value && value > 0) {
+            return value;
+        }
+        return DEFAULT_BUFSIZ;
+    }
+
+    explicit TransferPlanner(size_t bufsiz = read_bufsiz()) : bufsiz_(bufsiz) {}
+
+    size_t bufsiz() const { return bufsiz_; }
+
+    size_t messages_for(size_t len) const { return (len + bufsiz_ - 1) / bufsiz_; }
+
+    // Clock settings stamped into every transfer, so drivers sharing a
+    // controller can take turns without SPI_IOC_WR_MAX_SPEED_HZ or
+    // SPI_IOC_WR_BITS_PER_WORD ioctls. Zero means the device's default.
+    void set_clock(uint32_t speed_hz, uint8_t bits_per_word) {
+        speed_hz_ = speed_hz;
+        bits_per_word_ = bits_per_word;
+    }
+
+    spi_ioc_transfer transfer(const uint8_t* tx, size_t len) const {
+        spi_ioc_transfer xfer{};
+        xfer.tx_buf = reinterpret_cast<uintptr_t>(tx);
+        xfer.len = static_cast<uint32_t>(len);
+        xfer.speed_hz = speed_hz_;
+        xfer.bits_per_word = bits_per_word_;
+        return xfer;
+    }
+
+    // e.g. "115200 B -> 28 x 4096 B + 1 x 512 B (bufsiz 4096)"
+    std::string describe(size_t len) const {
+        const size_t full = len / bufsiz_;
+        const size_t tail = len % bufsiz_;
+        std::string out = std::to_string(len) + " B -> ";
+        if (full) {
+            out += std::to_string(full) + " x " + std::to_string(bufsiz_) + " B";
+        }
+        if (tail) {
+            out += std::string(full ? " + " : "") + "1 x " + std::to_string(tail) + " B";
+        }
+        return out + " (bufsiz " + std::to_string(bufsiz_) + ")";
+    }
+
+    // Streams a contiguous payload in bufsiz-sized messages.
+    void write(int fd, const uint8_t* data, size_t len, SpiStats& stats) const {
+        std::vector<spi_ioc_transfer> xfer;
+        while (len) {
+            const size_t n = std::min(len, bufsiz_);
+            xfer.assign(1, transfer(data, n));
+            send_message(fd, xfer, stats);
+            data += n;
+            len -= n;
+        }
+    }
+
+private:
+    size_t bufsiz_;
+    uint32_t speed_hz_ = 0;
+    uint8_t bits_per_word_ = 0;
+};
+
+// Accumulates command/data segments and submits them with as few syscalls as
+// the DC line allows: consecutive segments at the same DC level go out as one
+// SPI_IOC_MESSAGE(n), and the DC line is only touched on a level change. Runs
+// longer than the planner's bufsiz are split across messages.
+//
+// Segment bytes live in a reusable arena owned by the transaction, so building
+// a command does not allocate once the arena has grown to its working size.
+class SpiTransaction {
+public:
+    // Called with the DC level before each run of segments. `first` is true for
+    // the first run of a submit so the driver can assert CS in the same ioctl.
+    using DcSetter = std::function<void(bool dc, bool first)>;
+
+    SpiTransaction& command(uint8_t cmd, std::initializer_list<uint8_t> args = {}) {
+        push(false, &cmd, 1, args.size() == 0);
+        if (args.size()) {
+            push(true, args.begin(), args.size(), true);
+        }
+        return *this;
+    }
+
+    SpiTransaction& command(uint8_t cmd, const uint8_t* args, size_t len) {
+        push(false, &cmd, 1, len == 0);
+        if (len) {
+            push(true, args, len, true);
+        }
+        return *this;
+    }
+
+    // Payload that is not copied into the arena; it must outlive submit().
+    SpiTransaction& data_ref(const uint8_t* data, size_t len, bool cs_change = false) {
+        segments_.push_back({true, data, 0, len, cs_change});
+        return *this;
+    }
+
+    bool empty() const { return segments_.empty(); }
+
+    void clear() {
+        arena_.clear();
+        segments_.clear();
+    }
+
+    // Sends everything queued so far and resets the transaction. `leave_dc` is
+    // the level the caller wants once the transfer is done (e.g. DC high after
+    // RAMWR so pixel data can follow), or -1 to leave DC where the last run put it.
+    void submit(int fd, const TransferPlanner& plan, const DcSetter& set_dc, SpiStats& stats,
+                int leave_dc = -1) {
+        int dc = -1;
+        size_t i = 0;
+        try {
+            while (i < segments_.size()) {
+                size_t end = i;
+                while (end < segments_.size() && segments_[end].dc == segments_[i].dc) {
+                    ++end;
+                }
+
+                if (dc != segments_[i].dc) {
+                    dc = segments_[i].dc;
+                    set_dc(dc, i == 0);
+                }
+
+                send_run(fd, plan, i, end, stats);
+                i = end;
+            }
+        } catch (...) {
+            clear();
+            throw;
+        }
+
+        if (leave_dc >= 0 && leave_dc != dc) {
+            set_dc(leave_dc != 0, dc < 0);
+        }
+
+        clear();
+    }
+
+private:
+    // SPI_IOC_MESSAGE(n) encodes the array size in 14 ioctl size bits.
+    static constexpr size_t MAX_TRANSFERS = 256;
+
+    struct Segment {
+        bool dc;
+        const uint8_t* ref;
+        size_t offset;
+        size_t len;
+        bool cs_change;
+    };
+
+    void push(bool dc, const uint8_t* data, size_t len, bool cs_change) {
+        segments_.push_back({dc, nullptr, arena_.size(), len, cs_change});
+        arena_.insert(arena_.end(), data, data + len);
+    }
+
+    // Packs segments [begin, end) into messages of at most bufsiz bytes,
+    // slicing a segment across messages when it does not fit.
+    void send_run(int fd, const TransferPlanner& plan, size_t begin, size_t end, SpiStats& stats) {
+        xfers_.clear();
+        size_t budget = plan.bufsiz();
+        for (size_t s = begin; s < end; ++s) {
+            const Segment& seg = segments_[s];
+            const uint8_t* tx = seg.ref ? seg.ref : arena_.data() + seg.offset;
+            size_t left = seg.len;
+            while (left) {
+                if (!budget || xfers_.size() == MAX_TRANSFERS) {
+                    xfers_.back().cs_change = 0;
+                    send_message(fd, xfers_, stats);
+                    xfers_.clear();
+                    budget = plan.bufsiz();
+                }
+                const size_t n = std::min(left, budget);
+                spi_ioc_transfer xfer = plan.transfer(tx, n);
+                // Deselect between commands, but never after the last transfer
+                // of a message: in spidev that would leave CS asserted.
+                xfer.cs_change = (seg.cs_change && n == left && s + 1 != end) ? 1 : 0;
+                xfers_.push_back(xfer);
+                tx += n;
+                left -= n;
+                budget -= n;
+            }
+        }
+        if (!xfers_.empty()) {
+            xfers_.back().cs_change = 0;
+            send_message(fd, xfers_, stats);
+        }
+        xfers_.clear();
+    }
+
+    std::vector<uint8_t> arena_;
+    std::vector<Segment> segments_;
+    std::vector<spi_ioc_transfer> xfers_;
+};
+
+constexpr size_t MAX_INIT_ARGS = 16;
+constexpr uint16_t MAX_INIT_DELAY_MS = 1000;
+
+// One controller command in a constexpr init table: the command byte, its
+// parameters, and what has to happen before the next command may be sent.
+struct InitStep {
+    uint8_t cmd;
+    uint8_t nargs;
+    std::array<uint8_t, MAX_INIT_ARGS> args;
+    uint16_t delay_ms;
+    const char* wait_busy;  // non-null: block on the BUSY line, labelled for logs
+};
+
+// Too many arguments is a compile error when used in a constexpr table.
+constexpr InitStep init_cmd(uint8_t cmd, std::initializer_list<uint8_t> args = {},
+                            uint16_t delay_ms = 0) {
+    if (args.size() > MAX_INIT_ARGS) {
+        throw std::logic_error("init step has too many arguments");
+    }
+    InitStep step{cmd, static_cast<uint8_t>(args.size()), {}, delay_ms, nullptr};
+    size_t i = 0;
+    for (uint8_t arg : args) {
+        step.args[i++] = arg;
+    }
+    return step;
+}
+
+constexpr InitStep init_cmd_wait_busy(uint8_t cmd, const char* stage,
+                                      std::initializer_list<uint8_t> args = {}) {
+    InitStep step = init_cmd(cmd, args);
+    step.wait_busy = stage;
+    return step;
+}
+
+// Generic checks, plus the argument count of every command named in `arity`
+// (pairs of command byte and expected count). Meant for static_assert.
+template <size_t N>
+constexpr bool valid_init(const std::array<InitStep, N>& steps,
+                          std::initializer_list<std::pair<uint8_t, uint8_t>> arity = {}) {
+    for (const InitStep& step : steps) {
+        if (step.nargs > MAX_INIT_ARGS || step.delay_ms > MAX_INIT_DELAY_MS) {
+            return false;
+        }
+        for (size_t i = step.nargs; i < MAX_INIT_ARGS; ++i) {
+            if (step.args[i] != 0) {
+                return false;
+            }
+        }
+        for (const auto& [cmd, count] : arity) {
+            if (step.cmd == cmd && step.nargs != count) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace pidisp
@@ -0,0 +1,392 @@
+#pragma once
+
+#include <poll.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pidisp {
+
+class Executor;
+
+namespace detail {
+
+inline Executor*& current_executor() {
+    thread_local Executor* executor = nullptr;
+    return executor;
+}
+
+template <typename T>
+struct TaskResult {
+    std::optional<T> value;
+    void return_value(T v) { value = std::move(v); }
+    T take() { return std::move(*value); }
+};
+
+template <>
+struct TaskResult<void> {
+    void return_void() {}
+    void take() {}
+};
+
+}  // namespace detail
+
+// A lazily started coroutine producing T. co_await runs it and resumes the
+// awaiter when it finishes; get() runs it to completion on the calling thread.
+//
+// The awaitables below (delay(), readable()) only suspend when the thread is
+// running an Executor. Anywhere else they block in place, exactly like the
+// sleep or poll they replace, so a driver written as tasks still has a plain
+// blocking API: `display_async(...).get()` behaves like the old display().
+template <typename T = void>
+class [[nodiscard]] Task {
+public:
+    struct promise_type : detail::TaskResult<T> {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr error;
+
+        Task get_return_object() { return Task(Handle::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+
+        auto final_suspend() noexcept {
+            struct Final {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                    const auto next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            return Final{};
+        }
+
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool done() const { return !handle_ || handle_.done(); }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    T await_resume() { return result(); }
+
+    // Blocking run. Inside an executor the task would suspend with nobody to
+    // resume it, so there it must be co_awaited or spawned instead.
+    T get() {
+        if (detail::current_executor()) {
+            throw std::logic_error("Task::get() called on an executor thread; co_await it instead");
+        }
+        handle_.resume();
+        if (!handle_.done()) {
+            throw std::logic_error("task suspended outside an executor");
+        }
+        return result();
+    }
+
+private:
+    friend class Executor;
+
+    explicit Task(Handle handle) : handle_(handle) {}
+
+    T result() {
+        if (handle_.promise().error) {
+            std::rethrow_exception(handle_.promise().error);
+        }
+        return handle_.promise().take();
+    }
+
+    Handle handle_;
+};
+
+// Runs tasks cooperatively on one thread. A task that awaits delay() or
+// readable() parks its coroutine in a timer heap or a poll set, and the
+// executor resumes whichever is due next, so one panel's BUSY wait or
+// controller delay becomes time for the other panel's frames. Nothing is
+// shared between threads, so the tasks need no locks.
+class Executor {
+public:
+    struct Stats {
+        size_t resumes = 0;
+        std::chrono::microseconds idle{};  // blocked in ppoll() with every task waiting
+    };
+
+    Executor() = default;
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Tasks may also be spawned by running tasks, e.g. one per accepted
+    // connection. Finished tasks are dropped as the executor goes.
+    void spawn(Task<> task) {
+        ready_.push_back(task.handle_);
+        tasks_.push_back(std::move(task));
+    }
+
+    // Runs until every spawned task has finished or stop() is called, then
+    // rethrows the first failure. A failing task does not cancel the others.
+    void run() {
+        Executor*& current = detail::current_executor();
+        if (current) {
+            throw std::logic_error("executors do not nest");
+        }
+        current = this;
+        try {
+            loop();
+        } catch (...) {
+            current = nullptr;
+            throw;
+        }
+        current = nullptr;
+
+        // After stop() the remaining tasks are destroyed where they are
+        // suspended, which unwinds their locals like an exception would.
+        stop_ = false;
+        ready_.clear();
+        timers_ = {};
+        watches_.clear();
+        tasks_.clear();
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
+    }
+
+    // Makes run() return once the calling task suspends, for services whose
+    // tasks never finish on their own.
+    void stop() { stop_ = true; }
+
+    const Stats& stats() const { return stats_; }
+
+    // Awaitable plumbing, used by delay(), readable() and Event.
+    void post(std::coroutine_handle<> h) { ready_.push_back(h); }
+
+    void resume_at(std::chrono::steady_clock::time_point when, std::coroutine_handle<> h) {
+        timers_.push({when, seq_++, h});
+    }
+
+    void resume_on_readable(int fd, std::chrono::steady_clock::time_point deadline, bool* fired,
+                            std::coroutine_handle<> h) {
+        watches_.push_back({fd, deadline, fired, h});
+    }
+
+private:
+    struct Timer {
+        std::chrono::steady_clock::time_point when;
+        uint64_t seq;
+        std::coroutine_handle<> handle;
+        bool operator>(const Timer& other) const {
+            return when != other.when ? when > other.when : seq > other.seq;
+        }
+    };
+
+    struct Watch {
+        int fd;
+        std::chrono::steady_clock::time_point deadline;
+        bool* fired;
+        std::coroutine_handle<> handle;
+    };
+
+    void loop() {
+        for (;;) {
+            while (!ready_.empty()) {
+                const auto h = ready_.front();
+                ready_.pop_front();
+                ++stats_.resumes;
+                h.resume();
+                if (stop_) {
+                    return;
+                }
+            }
+            reap();
+            if (tasks_.empty()) {
+                return;
+            }
+            if (timers_.empty() && watches_.empty()) {
+                throw std::logic_error("every task is suspended with nothing left to wake it");
+            }
+            wait();
+        }
+    }
+
+    void reap() {
+        const auto done =
+            std::partition(tasks_.begin(), tasks_.end(), [](const Task<>& t) { return !t.done(); });
+        for (auto it = done; it != tasks_.end(); ++it) {
+            if (it->handle_.promise().error && !error_) {
+                error_ = it->handle_.promise().error;
+            }
+        }
+        tasks_.erase(done, tasks_.end());
+    }
+
+    // Sleeps in ppoll() until the next timer or watched fd, then queues
+    // everything that became due.
+    void wait() {
+        auto next = std::chrono::steady_clock::time_point::max();
+        if (!timers_.empty()) {
+            next = timers_.top().when;
+        }
+        fds_.clear();
+        for (const Watch& w : watches_) {
+            next = std::min(next, w.deadline);
+            fds_.push_back({w.fd, POLLIN, 0});
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        const auto timeout = std::max(next - start, std::chrono::steady_clock::duration::zero());
+        const auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        const timespec ts{static_cast<time_t>(secs.count()),
+                          static_cast<long>(std::chrono::nanoseconds(timeout - secs).count())};
+        const int n = ppoll(fds_.data(), fds_.size(), &ts, nullptr);
+        if (n < 0 && errno != EINTR) {
+            throw std::runtime_error("ppoll failed: " + std::string(std::strerror(errno)));
+        }
+        const auto now = std::chrono::steady_clock::now();
+        stats_.idle += std::chrono::duration_cast<std::chrono::microseconds>(now - start);
+
+        while (!timers_.empty() && timers_.top().when <= now) {
+            ready_.push_back(timers_.top().handle);
+            timers_.pop();
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < watches_.size(); ++i) {
+            const bool readable = n > 0 && (fds_[i].revents & (POLLIN | POLLERR | POLLHUP));
+            if (readable || watches_[i].deadline <= now) {
+                *watches_[i].fired = readable;
+                ready_.push_back(watches_[i].handle);
+            } else {
+                watches_[kept++] = watches_[i];
+            }
+        }
+        watches_.resize(kept);
+    }
+
+    std::vector<Task<>> tasks_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers_;
+    std::vector<Watch> watches_;
+    std::vector<pollfd> fds_;
+    uint64_t seq_ = 0;
+    bool stop_ = false;
+    std::exception_ptr error_;
+    Stats stats_;
+};
+
+// co_await delay(d): yields the thread to other tasks for `d` under an
+// executor, sleeps otherwise.
+struct Delay {
+    std::chrono::steady_clock::duration duration;
+
+    bool await_ready() const {
+        if (!detail::current_executor()) {
+            std::this_thread::sleep_for(duration);
+            return true;
+        }
+        return duration <= std::chrono::steady_clock::duration::zero();
+    }
+    void await_suspend(std::coroutine_handle<> h) const {
+        detail::current_executor()->resume_at(std::chrono::steady_clock::now() + duration, h);
+    }
+    void await_resume() const {}
+};
+
+template <typename Rep, typename Period>
+Delay delay(std::chrono::duration<Rep, Period> d) {
+    return {std::chrono::duration_cast<std::chrono::steady_clock::duration>(d)};
+}
+
+// co_await readable(fd, deadline): true once `fd` polls readable, false if
+// `deadline` passed first.
+struct Readable {
+    int fd;
+    std::chrono::steady_clock::time_point deadline;
+    bool fired = false;
+
+    bool await_ready() {
+        if (detail::current_executor()) {
+            return false;
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        pollfd pfd{fd, POLLIN, 0};
+        fired = poll(&pfd, 1, int(std::max<int64_t>(left.count() + 1, 0))) > 0;
+        return true;
+    }
+    void await_suspend(std::coroutine_handle<> h) {
+        detail::current_executor()->resume_on_readable(fd, deadline, &fired, h);
+    }
+    bool await_resume() const { return fired; }
+};
+
+inline Readable readable(int fd, std::chrono::steady_clock::time_point deadline) {
+    return {fd, deadline};
+}
+
+// Auto-reset wakeup between tasks on one executor: `co_await event.wait()`
+// returns at once if set() was called since the last wait, else suspends
+// until the next set(). Meant for a single waiting task, e.g. a consumer
+// woken by producers that queue work for it.
+class Event {
+public:
+    void set() {
+        if (waiter_) {
+            detail::current_executor()->post(std::exchange(waiter_, {}));
+        } else {
+            set_ = true;
+        }
+    }
+
+    auto wait() {
+        struct Awaiter {
+            Event& event;
+            bool await_ready() const { return std::exchange(event.set_, false); }
+            void await_suspend(std::coroutine_handle<> h) {
+                if (!detail::current_executor()) {
+                    throw std::logic_error("Event::wait() needs an executor");
+                }
+                event.waiter_ = h;
+            }
+            void await_resume() const {}
+        };
+        return Awaiter{*this};
+    }
+
+private:
+    bool set_ = false;
+    std::coroutine_handle<> waiter_;
+};
+
+}  // namespace pidisp